@@ -259,7 +259,10 @@ OMAPDRI2CreateBuffer(DrawablePtr pDraw, unsigned int attachment,
 		}
 	}
 
-	bo = OMAPPixmapBo(pPixmap);
+	/* let the EXA submodule keep the buffer mapped to the GPU, and
+	 * in a bo of its own
+	 */
+	OMAPPixmapPin(pPixmap, 1);
 
 	DRIBUF(buf)->attachment = attachment;
 	DRIBUF(buf)->pitch = exaGetPixmapPitch(pPixmap);
@@ -268,6 +271,15 @@ OMAPDRI2CreateBuffer(DrawablePtr pDraw, unsigned int attachment,
 	buf->refcnt = 1;
 	buf->pPixmap = pPixmap;
 
+	if (pOMAP->pOMAPEXA->ExportPixmap &&
+			!pOMAP->pOMAPEXA->ExportPixmap(pPixmap)) {
+		ERROR_MSG("could not export pixmap");
+		OMAPDRI2DestroyBuffer(pDraw, DRIBUF(buf));
+		return NULL;
+	}
+
+	bo = OMAPPixmapBo(pPixmap);
+
 	ret = omap_bo_get_name(bo, &DRIBUF(buf)->name);
 	if (ret) {
 		ERROR_MSG("could not get buffer name: %d", ret);
@@ -296,6 +308,8 @@ OMAPDRI2DestroyBuffer(DrawablePtr pDraw, DRI2BufferPtr buffer)
 
 	DEBUG_MSG("pDraw=%p, buffer=%p", pDraw, buffer);
 
+	OMAPPixmapPin(buf->pPixmap, -1);
+
 	pScreen->DestroyPixmap(buf->pPixmap);
 
 	free(buf);
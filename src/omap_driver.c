@@ -120,6 +120,15 @@ typedef enum {
 	OPTION_HW_CURSOR,
 	OPTION_TRIPLE_BUFFER,
 	OPTION_MANUAL_UPDATE,
+	OPTION_BO_CACHE_TOLERANCE,
+	OPTION_BO_CACHE_SIZE,
+	OPTION_BO_CACHE_TIMEOUT,
+	OPTION_BO_CACHE_SPECIAL_SIZE,
+	OPTION_GPU_MAP_SIZE,
+	OPTION_SW_FILL_AREA,
+	OPTION_SW_THREADS,
+	OPTION_HW_COMPOSITE,
+	OPTION_HW_COMPOSITE_CHECK,
 	/* TODO: probably need to add an option to let user specify bus-id */
 } OMAPOpts;
 
@@ -131,6 +140,15 @@ static const OptionInfoRec OMAPOptions[] = {
 	{ OPTION_HW_CURSOR,	"HWcursor",	OPTV_BOOLEAN,	{0},	FALSE },
 	{ OPTION_TRIPLE_BUFFER,	"TripleBuffer",	OPTV_BOOLEAN,	{0},	FALSE },
 	{ OPTION_MANUAL_UPDATE,	"ManualUpdate",	OPTV_BOOLEAN,	{0},	FALSE },
+	{ OPTION_BO_CACHE_TOLERANCE, "BOCacheTolerance", OPTV_INTEGER, {0},	FALSE },
+	{ OPTION_BO_CACHE_SIZE,	"BOCacheSize",	OPTV_INTEGER,	{0},	FALSE },
+	{ OPTION_BO_CACHE_TIMEOUT, "BOCacheTimeout", OPTV_INTEGER, {0},	FALSE },
+	{ OPTION_BO_CACHE_SPECIAL_SIZE, "BOCacheSpecialSize", OPTV_INTEGER, {0}, FALSE },
+	{ OPTION_GPU_MAP_SIZE,	"GPUMapSize",	OPTV_INTEGER,	{0},	FALSE },
+	{ OPTION_SW_FILL_AREA,	"SWFillArea",	OPTV_INTEGER,	{0},	FALSE },
+	{ OPTION_SW_THREADS,	"SWThreads",	OPTV_INTEGER,	{0},	FALSE },
+	{ OPTION_HW_COMPOSITE,	"HWComposite",	OPTV_STRING,	{0},	FALSE },
+	{ OPTION_HW_COMPOSITE_CHECK, "HWCompositeCheck", OPTV_BOOLEAN, {0}, FALSE },
 	{ -1,			NULL,		OPTV_NONE,	{0},	FALSE }
 };
 
@@ -317,6 +335,9 @@ OMAPGetRec(ScrnInfoPtr pScrn)
 	if (pScrn->driverPrivate == NULL)
 		return FALSE;
 
+	OMAPPoolInit(&OMAPPTR(pScrn)->PixmapPrivPool,
+			sizeof(OMAPPixmapPrivRec), 1024);
+
 	return TRUE;
 }
 
@@ -330,6 +351,7 @@ OMAPFreeRec(ScrnInfoPtr pScrn)
 {
 	if (pScrn->driverPrivate == NULL)
 		return;
+	OMAPPoolFini(&OMAPPTR(pScrn)->PixmapPrivPool);
 	free(pScrn->driverPrivate);
 	pScrn->driverPrivate = NULL;
 }
@@ -599,6 +621,41 @@ OMAPPreInit(ScrnInfoPtr pScrn, int flags)
 	pOMAP->NoAccel = xf86ReturnOptValBool(pOMAP->pOptionInfo,
 			OPTION_NO_ACCEL, FALSE);
 
+	/* How much bigger (in percent) a recycled BO may be than requested: */
+	pOMAP->BoCacheTolerance = 25;
+	xf86GetOptValInteger(pOMAP->pOptionInfo, OPTION_BO_CACHE_TOLERANCE,
+			&pOMAP->BoCacheTolerance);
+
+	/* Upper limit (KiB) and max idle time (ms) of cached BOs: */
+	pOMAP->BoCacheSize = 16 * 1024;
+	xf86GetOptValInteger(pOMAP->pOptionInfo, OPTION_BO_CACHE_SIZE,
+			&pOMAP->BoCacheSize);
+	pOMAP->BoCacheTimeout = 2000;
+	xf86GetOptValInteger(pOMAP->pOptionInfo, OPTION_BO_CACHE_TIMEOUT,
+			&pOMAP->BoCacheTimeout);
+	pOMAP->BoCacheSpecialSize = 32 * 1024;
+	xf86GetOptValInteger(pOMAP->pOptionInfo, OPTION_BO_CACHE_SPECIAL_SIZE,
+			&pOMAP->BoCacheSpecialSize);
+	pOMAP->GPUMapSize = 0;
+	xf86GetOptValInteger(pOMAP->pOptionInfo, OPTION_GPU_MAP_SIZE,
+			&pOMAP->GPUMapSize);
+
+	/* Fill batches up to this many pixels are done by the CPU if the GPU is idle: */
+	pOMAP->SWFillArea = 4096;
+	xf86GetOptValInteger(pOMAP->pOptionInfo, OPTION_SW_FILL_AREA,
+			&pOMAP->SWFillArea);
+
+	/* Software rendering worker threads, -1 for one per extra core: */
+	pOMAP->SWThreads = -1;
+	xf86GetOptValInteger(pOMAP->pOptionInfo, OPTION_SW_THREADS,
+			&pOMAP->SWThreads);
+
+	/* Render ops and destination formats the GPU composites, none by default: */
+	pOMAP->HWComposite = xf86GetOptValString(pOMAP->pOptionInfo,
+			OPTION_HW_COMPOSITE);
+	pOMAP->HWCompositeCheck = xf86ReturnOptValBool(pOMAP->pOptionInfo,
+			OPTION_HW_COMPOSITE_CHECK, FALSE);
+
 	/*
 	 * Select the video modes:
 	 */
@@ -715,6 +772,12 @@ OMAPAccelInit(ScreenPtr pScreen)
 		pOMAP->pOMAPEXA = InitNullEXA(pScreen, pScrn, pOMAP->drmFD);
 	}
 
+	/* the PVR submodule composites what the GPU can't do in bands too */
+	pOMAP->Threads = OMAPThreadsInit(pOMAP->SWThreads);
+	if (pOMAP->Threads) {
+		INFO_MSG("Using worker threads for software rendering");
+	}
+
 	if (pOMAP->dri && pOMAP->pOMAPEXA) {
 		pOMAP->dri = OMAPDRI2ScreenInit(pScreen);
 	} else {
@@ -940,6 +1003,9 @@ OMAPCloseScreen(CLOSE_SCREEN_ARGS_DECL)
 		pOMAP->pOMAPEXA = NULL;
 	}
 
+	OMAPThreadsFini(pOMAP->Threads);
+	pOMAP->Threads = NULL;
+
 	if (pOMAP->dri) {
 		OMAPDRI2CloseScreen(pScreen);
 	}
@@ -993,6 +1059,9 @@ OMAPBlockHandler(BLOCKHANDLER_ARGS_DECL)
 	(*pScreen->BlockHandler) (BLOCKHANDLER_ARGS);
 	swap(pOMAP, pScreen, BlockHandler);
 
+	if (pOMAP->pOMAPEXA && pOMAP->pOMAPEXA->BlockHandler)
+		pOMAP->pOMAPEXA->BlockHandler(pScreen, pTimeout);
+
 	/* TODO OMAPVideoBlockHandler(), etc.. */
 }
 
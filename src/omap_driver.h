@@ -137,10 +137,25 @@ typedef struct _OMAPRec
 	Bool				NoAccel;
 	Bool				TripleBuffer;
 	Bool				ManualUpdate;
+	int					BoCacheTolerance;
+	int					BoCacheSize;
+	int					BoCacheTimeout;
+	int					BoCacheSpecialSize;
+	int					GPUMapSize;
+	int					SWFillArea;
+	int					SWThreads;
+	const char			*HWComposite;
+	Bool				HWCompositeCheck;
 
 	/** File descriptor of the connection with the DRM. */
 	int					drmFD;
 
+	/** Recycled OMAPPixmapPrivRec's */
+	OMAPPoolRec			PixmapPrivPool;
+
+	/** Software rendering worker threads, NULL if there are none */
+	OMAPThreadsPtr		Threads;
+
 	char 				*deviceName;
 
 	/** DRM device instance */
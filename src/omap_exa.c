@@ -49,6 +49,15 @@ OMAPEXAPTR(ScrnInfoPtr pScrn)
  * can use OMAPPrixmapPrivPtr#priv for their own private data.
  */
 
+static void
+OMAPPixmapPinned(PixmapPtr pPixmap)
+{
+	OMAPEXAPtr pOMAPEXA = OMAPEXAPTR(pix2scrn(pPixmap));
+
+	if (pOMAPEXA && pOMAPEXA->PixmapPinned)
+		pOMAPEXA->PixmapPinned(pPixmap);
+}
+
 /* used by DRI2 code to play buffer switcharoo */
 void
 OMAPPixmapExchange(PixmapPtr a, PixmapPtr b)
@@ -57,6 +66,76 @@ OMAPPixmapExchange(PixmapPtr a, PixmapPtr b)
 	OMAPPixmapPrivPtr bpriv = exaGetPixmapDriverPrivate(b);
 	exchange(apriv->priv, bpriv->priv);
 	exchange(apriv->bo, bpriv->bo);
+	exchange(apriv->offset, bpriv->offset);
+
+	/* the DRI2 buffers stay with the pixmaps, not with the bos */
+	OMAPPixmapPinned(a);
+	OMAPPixmapPinned(b);
+}
+
+/* count DRI2 buffers referencing the pixmap in or out */
+void
+OMAPPixmapPin(PixmapPtr pPixmap, int count)
+{
+	OMAPPixmapPrivPtr priv = exaGetPixmapDriverPrivate(pPixmap);
+
+	priv->pinned += count;
+	OMAPPixmapPinned(pPixmap);
+}
+
+_X_EXPORT void
+OMAPPoolInit(OMAPPoolPtr pool, size_t size, unsigned int max)
+{
+	pool->free = NULL;
+	pool->count = 0;
+	pool->max = max;
+	/* free records store the link in their first bytes */
+	pool->size = size < sizeof(void *) ? sizeof(void *) : size;
+}
+
+_X_EXPORT void
+OMAPPoolFini(OMAPPoolPtr pool)
+{
+	while (pool->free) {
+		void *p = pool->free;
+
+		pool->free = *(void **)p;
+		free(p);
+	}
+
+	pool->count = 0;
+}
+
+/* returns a zeroed record */
+_X_EXPORT void *
+OMAPPoolAlloc(OMAPPoolPtr pool)
+{
+	void *p = pool->free;
+
+	if (!p)
+		return calloc(pool->size, 1);
+
+	pool->free = *(void **)p;
+	pool->count--;
+	memset(p, 0, pool->size);
+
+	return p;
+}
+
+_X_EXPORT void
+OMAPPoolFree(OMAPPoolPtr pool, void *p)
+{
+	if (!p)
+		return;
+
+	if (pool->count >= pool->max) {
+		free(p);
+		return;
+	}
+
+	*(void **)p = pool->free;
+	pool->free = p;
+	pool->count++;
 }
 
 _X_EXPORT void *
@@ -64,7 +143,8 @@ OMAPCreatePixmap (ScreenPtr pScreen, int width, int height,
 		int depth, int usage_hint, int bitsPerPixel,
 		int *new_fb_pitch)
 {
-	OMAPPixmapPrivPtr priv = calloc(sizeof(OMAPPixmapPrivRec), 1);
+	OMAPPtr pOMAP = OMAPPTR_FROM_SCREEN(pScreen);
+	OMAPPixmapPrivPtr priv = OMAPPoolAlloc(&pOMAP->PixmapPrivPool);
 
 	/* actual allocation of buffer is in OMAPModifyPixmapHeader */
 
@@ -83,7 +163,7 @@ OMAPDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 	if (priv->bo != pOMAP->scanout)
 		omap_bo_del(priv->bo);
 
-	free(priv);
+	OMAPPoolFree(&pOMAP->PixmapPrivPool, priv);
 }
 
 _X_EXPORT Bool
@@ -107,6 +187,7 @@ OMAPModifyPixmapHeader(PixmapPtr pPixmap, int width, int height,
 		DEBUG_MSG("wrapping scanout buffer");
 		pPixmap->devPrivate.ptr = pPixData;
 		priv->bo = pOMAP->scanout;
+		priv->offset = 0;
 		return TRUE;
 	} else if (pPixData) {
 		/* we can't accelerate this pixmap, and don't ever want to
@@ -169,6 +250,7 @@ OMAPModifyPixmapHeader(PixmapPtr pPixmap, int width, int height,
 	if ((!priv->bo) || (omap_bo_size(priv->bo) != size)) {
 		/* re-allocate buffer! */
 		omap_bo_del(priv->bo);
+		priv->offset = 0;
 		if (flags & OMAP_BO_TILED) {
 			priv->bo = omap_bo_new_tiled(pOMAP->dev, width, height, flags);
 			priv->tiled = TRUE;
@@ -252,12 +334,14 @@ _X_EXPORT Bool
 OMAPPrepareAccess(PixmapPtr pPixmap, int index)
 {
 	OMAPPixmapPrivPtr priv = exaGetPixmapDriverPrivate(pPixmap);
+	char *map = omap_bo_map(priv->bo);
 
-	pPixmap->devPrivate.ptr = omap_bo_map(priv->bo);
-	if (!pPixmap->devPrivate.ptr) {
+	if (!map) {
 		return FALSE;
 	}
 
+	pPixmap->devPrivate.ptr = map + priv->offset;
+
 	/* wait for blits complete.. note we could be a bit more clever here
 	 * for non-DRI2 buffers and use separate OMAP{Prepare,Finish}GPUAccess()
 	 * fxns wrapping accelerated GPU operations.. this way we don't have
@@ -71,6 +71,26 @@ typedef struct _OMAPEXARec
 			unsigned int extraCount, PixmapPtr *extraPix,
 			unsigned int format);
 
+	/**
+	 * Called from the X driver's BlockHandler(), before the server goes
+	 * to sleep, so the submodule can do deferred housekeeping.  pTimeout
+	 * can be shortened if the submodule needs to be woken up again.
+	 */
+	void (*BlockHandler)(ScreenPtr pScreen, pointer pTimeout);
+
+	/**
+	 * Called before the bo of a pixmap is shared with a DRI2 client.  If
+	 * the submodule packs several pixmaps into one bo, it has to move the
+	 * pixmap to a bo of its own.
+	 */
+	Bool (*ExportPixmap)(PixmapPtr pPixmap);
+
+	/**
+	 * Called when the count of DRI2 buffers referencing a pixmap
+	 * changed, or the pixmap got the bo of another one.
+	 */
+	void (*PixmapPinned)(PixmapPtr pPixmap);
+
 	/* add new fields here at end, to preserve ABI */
 
 	/* padding to keep ABI stable, so an existing EXA submodule
@@ -126,6 +146,8 @@ typedef struct {
 	struct omap_bo *bo;
 	Bool tiled;
 	uint32_t flags;
+	int pinned;			/* DRI2 buffers referencing the pixmap */
+	uint32_t offset;		/* of the pixmap in a shared bo */
 } OMAPPixmapPrivRec, *OMAPPixmapPrivPtr;
 
 #define OMAP_CREATE_PIXMAP_SCANOUT 0x80000000
@@ -151,6 +173,14 @@ OMAPPixmapBo(PixmapPtr pPixmap)
 	return priv->bo;
 }
 
+/* pixmaps sub-allocated from a shared bo start at an offset */
+static inline uint32_t
+OMAPPixmapOffset(PixmapPtr pPixmap)
+{
+	OMAPPixmapPrivPtr priv = exaGetPixmapDriverPrivate(pPixmap);
+	return priv->offset;
+}
+
 static inline Bool
 OMAPPixmapTiled(PixmapPtr pPixmap)
 {
@@ -159,5 +189,39 @@ OMAPPixmapTiled(PixmapPtr pPixmap)
 }
 
 void OMAPPixmapExchange(PixmapPtr a, PixmapPtr b);
+void OMAPPixmapPin(PixmapPtr pPixmap, int count);
+
+/**
+ * Pool of equally sized records.  Freed records are kept (up to max) and
+ * handed out again, so allocating pixmap privates needs no malloc in the
+ * steady state.
+ */
+typedef struct _OMAPPool
+{
+	void *free;			/* singly linked list of free records */
+	unsigned int count;
+	unsigned int max;
+	size_t size;
+} OMAPPoolRec, *OMAPPoolPtr;
+
+void OMAPPoolInit(OMAPPoolPtr pool, size_t size, unsigned int max);
+void OMAPPoolFini(OMAPPoolPtr pool);
+void *OMAPPoolAlloc(OMAPPoolPtr pool);
+void OMAPPoolFree(OMAPPoolPtr pool, void *p);
+
+/**
+ * Worker threads that split big software operations into horizontal
+ * bands, see omap_threads.c.
+ */
+typedef struct _OMAPThreads *OMAPThreadsPtr;
+typedef void (*OMAPBandProc)(void *closure, int y1, int y2);
+
+/* smaller operations are not worth waking the workers up for */
+#define OMAP_BANDS_MIN_AREA (64 * 1024)
+
+OMAPThreadsPtr OMAPThreadsInit(int count);
+void OMAPThreadsFini(OMAPThreadsPtr threads);
+void OMAPBandsRun(ScreenPtr pScreen, OMAPBandProc proc, void *closure,
+		int y1, int y2, int width);
 
 #endif /* OMAP_EXA_COMMON_H_ */
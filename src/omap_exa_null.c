@@ -40,40 +40,345 @@
  * chipset is not available.  (For example, on chipsets which used the closed
  * source IMG PowerVR EXA implementation, if the closed-source submodule is
  * not installed.
+ *
+ * Solid, Copy and Composite are still done here, with pixman on the mapped
+ * buffers, which saves EXA's generic fallback and its access bookkeeping.
  */
 
 typedef struct {
 	OMAPEXARec base;
 	ExaDriverPtr exa;
 	/* add any other driver private data here.. */
+
+	/* state of the current Solid/Copy/Composite operation: */
+	PixmapPtr pSrc, pDst;
+	FbBits *src, *dst;
+	FbStride srcStride, dstStride;
+	int alu;
+	FbBits pm;
+	uint32_t fill;
+	Bool reverse, upsidedown;
+	Bool inplace;		/* composite reads the destination pixmap */
+	pixman_op_t op;
+	PicturePtr pSrcPicture, pMaskPicture, pDstPicture;
+	pixman_image_t *srcImage, *maskImage, *dstImage;
 } OMAPNullEXARec, *OMAPNullEXAPtr;
 
+/* one Solid/Copy/Composite rect, split into bands by OMAPBandsRun() */
+typedef struct {
+	OMAPNullEXAPtr null_exa;
+	int bpp;
+	int srcX, srcY;
+	int maskX, maskY;
+	int dstX, dstY;
+	int width;
+} NullBandRec, *NullBandPtr;
+
+static inline OMAPNullEXAPtr
+NullEXAPTR(PixmapPtr pPixmap)
+{
+	return (OMAPNullEXAPtr)OMAPPTR(pix2scrn(pPixmap))->pOMAPEXA;
+}
+
+/* CPU address of the pixmap, bo's stay mapped once mapped */
+static FbBits *
+PixmapBits(PixmapPtr pPixmap)
+{
+	OMAPPixmapPrivPtr priv = exaGetPixmapDriverPrivate(pPixmap);
+	char *map;
+
+	if (!priv || !priv->bo)
+		return NULL;
+
+	map = omap_bo_map(priv->bo);
+
+	if (!map)
+		return NULL;
+
+	return (FbBits *)(map + priv->offset);
+}
+
+/* same as OMAPFinishAccess(), the display needs to know about changes */
+static void
+FlushPixmap(PixmapPtr pPixmap)
+{
+	ScrnInfoPtr pScrn = pix2scrn(pPixmap);
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
+
+	if (OMAPPixmapBo(pPixmap) == pOMAP->scanout)
+		drmmode_flush_scanout(pScrn);
+}
 
 static Bool
-PrepareSolidFail(PixmapPtr pPixmap, int alu, Pixel planemask, Pixel fill_colour)
+PrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask, Pixel fill_colour)
 {
-	return FALSE;
+	OMAPNullEXAPtr null_exa = NullEXAPTR(pPixmap);
+
+	if (!EXA_PM_IS_SOLID(&pPixmap->drawable, planemask))
+		return FALSE;
+
+	switch (alu) {
+	case GXcopy:
+		null_exa->fill = fill_colour;
+		break;
+	case GXclear:
+		null_exa->fill = 0;
+		break;
+	case GXset:
+		null_exa->fill = ~0;
+		break;
+	default:
+		return FALSE;
+	}
+
+	null_exa->dst = PixmapBits(pPixmap);
+	null_exa->dstStride = exaGetPixmapPitch(pPixmap) / sizeof(FbBits);
+	null_exa->pDst = pPixmap;
+
+	return null_exa->dst != NULL;
+}
+
+static void
+SolidBand(void *closure, int y1, int y2)
+{
+	NullBandPtr band = closure;
+	OMAPNullEXAPtr null_exa = band->null_exa;
+
+	pixman_fill((uint32_t *)null_exa->dst, null_exa->dstStride, band->bpp,
+			band->dstX, y1, band->width, y2 - y1, null_exa->fill);
+}
+
+static void
+Solid(PixmapPtr pPixmap, int x1, int y1, int x2, int y2)
+{
+	NullBandRec band = {
+			.null_exa = NullEXAPTR(pPixmap),
+			.bpp = pPixmap->drawable.bitsPerPixel,
+			.dstX = x1,
+			.width = x2 - x1,
+	};
+
+	OMAPBandsRun(pPixmap->drawable.pScreen, SolidBand, &band, y1, y2,
+			band.width);
+}
+
+static void
+DoneSolid(PixmapPtr pPixmap)
+{
+	FlushPixmap(pPixmap);
 }
 
 static Bool
-PrepareCopyFail(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir,
+PrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir,
 		int alu, Pixel planemask)
 {
-	return FALSE;
+	OMAPNullEXAPtr null_exa = NullEXAPTR(pDst);
+	int bpp = pDst->drawable.bitsPerPixel;
+
+	if (pSrc->drawable.bitsPerPixel != bpp)
+		return FALSE;
+
+	null_exa->src = PixmapBits(pSrc);
+	null_exa->dst = PixmapBits(pDst);
+
+	if (!null_exa->src || !null_exa->dst)
+		return FALSE;
+
+	null_exa->srcStride = exaGetPixmapPitch(pSrc) / sizeof(FbBits);
+	null_exa->dstStride = exaGetPixmapPitch(pDst) / sizeof(FbBits);
+	null_exa->pSrc = pSrc;
+	null_exa->pDst = pDst;
+	null_exa->alu = alu;
+	null_exa->pm = fbReplicatePixel(planemask, bpp);
+	null_exa->reverse = xdir < 0;
+	null_exa->upsidedown = ydir < 0;
+
+	return TRUE;
+}
+
+static void
+CopyBand(void *closure, int y1, int y2)
+{
+	NullBandPtr band = closure;
+	OMAPNullEXAPtr null_exa = band->null_exa;
+	int srcY = band->srcY + y1 - band->dstY;
+	int bpp = band->bpp;
+
+	/* pixman_blt() has the SIMD paths, but can't do overlapping copies */
+	if (null_exa->alu == GXcopy && null_exa->pm == FB_ALLONES &&
+			null_exa->pSrc != null_exa->pDst &&
+			pixman_blt((uint32_t *)null_exa->src, (uint32_t *)null_exa->dst,
+					null_exa->srcStride, null_exa->dstStride, bpp, bpp,
+					band->srcX, srcY, band->dstX, y1, band->width,
+					y2 - y1)) {
+		return;
+	}
+
+	fbBlt(null_exa->src + srcY * null_exa->srcStride, null_exa->srcStride,
+			band->srcX * bpp,
+			null_exa->dst + y1 * null_exa->dstStride, null_exa->dstStride,
+			band->dstX * bpp, band->width * bpp, y2 - y1, null_exa->alu,
+			null_exa->pm, bpp, null_exa->reverse, null_exa->upsidedown);
+}
+
+static void
+Copy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX, int dstY,
+		int width, int height)
+{
+	NullBandRec band = {
+			.null_exa = NullEXAPTR(pDstPixmap),
+			.bpp = pDstPixmap->drawable.bitsPerPixel,
+			.srcX = srcX,
+			.srcY = srcY,
+			.dstX = dstX,
+			.dstY = dstY,
+			.width = width,
+	};
+
+	/* bands of a copy within a pixmap could read each other's rows */
+	if (band.null_exa->pSrc == pDstPixmap)
+		CopyBand(&band, dstY, dstY + height);
+	else
+		OMAPBandsRun(pDstPixmap->drawable.pScreen, CopyBand, &band,
+				dstY, dstY + height, width);
+}
+
+static void
+DoneCopy(PixmapPtr pPixmap)
+{
+	FlushPixmap(pPixmap);
 }
 
 static Bool
-CheckCompositeFail(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
+CheckComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 		PicturePtr pDstPicture)
 {
-	return FALSE;
+	/* alpha maps would need their own pixmap mapped */
+	if (pDstPicture->alphaMap || pSrcPicture->alphaMap ||
+			(pMaskPicture && pMaskPicture->alphaMap))
+		return FALSE;
+
+	return TRUE;
+}
+
+/*
+ * image_from_pict() takes the bits from devPrivate.ptr, which is only set
+ * while EXA has the pixmap prepared for CPU access.
+ */
+static pixman_image_t *
+PictureImage(PicturePtr pPicture, PixmapPtr pPixmap)
+{
+	pixman_image_t *image;
+	void *ptr;
+	int xoff, yoff;
+
+	if (!pPixmap)
+		return image_from_pict(pPicture, FALSE, &xoff, &yoff);
+
+	ptr = pPixmap->devPrivate.ptr;
+	pPixmap->devPrivate.ptr = PixmapBits(pPixmap);
+
+	if (pPixmap->devPrivate.ptr)
+		image = image_from_pict(pPicture, FALSE, &xoff, &yoff);
+	else
+		image = NULL;
+
+	pPixmap->devPrivate.ptr = ptr;
+
+	return image;
+}
+
+static void
+FreeImages(OMAPNullEXAPtr null_exa)
+{
+	free_pixman_pict(null_exa->pSrcPicture, null_exa->srcImage);
+	null_exa->srcImage = NULL;
+
+	if (null_exa->pMaskPicture)
+		free_pixman_pict(null_exa->pMaskPicture, null_exa->maskImage);
+	null_exa->maskImage = NULL;
+
+	free_pixman_pict(null_exa->pDstPicture, null_exa->dstImage);
+	null_exa->dstImage = NULL;
 }
 
 static Bool
-PrepareCompositeFail(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
+PrepareComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 		PicturePtr pDstPicture, PixmapPtr pSrc, PixmapPtr pMask, PixmapPtr pDst)
 {
-	return FALSE;
+	OMAPNullEXAPtr null_exa = NullEXAPTR(pDst);
+
+	null_exa->op = op;
+	null_exa->pSrcPicture = pSrcPicture;
+	null_exa->pMaskPicture = pMaskPicture;
+	null_exa->pDstPicture = pDstPicture;
+
+	null_exa->pSrc = pSrc;
+	null_exa->pDst = pDst;
+	null_exa->srcImage = PictureImage(pSrcPicture, pSrc);
+	null_exa->maskImage = pMaskPicture ?
+			PictureImage(pMaskPicture, pMask) : NULL;
+	null_exa->dstImage = PictureImage(pDstPicture, pDst);
+
+	if (!null_exa->srcImage || !null_exa->dstImage ||
+			(pMaskPicture && !null_exa->maskImage)) {
+		FreeImages(null_exa);
+		return FALSE;
+	}
+
+	/* pixman validates the images on their first use, do that here and
+	 * not concurrently from the worker threads
+	 */
+	pixman_image_composite32(op, null_exa->srcImage, null_exa->maskImage,
+			null_exa->dstImage, 0, 0, 0, 0, 0, 0, 0, 0);
+
+	/* bands would read rows other bands write */
+	null_exa->inplace = pSrc == pDst || (pMask && pMask == pDst);
+
+	return TRUE;
+}
+
+static void
+CompositeBand(void *closure, int y1, int y2)
+{
+	NullBandPtr band = closure;
+	OMAPNullEXAPtr null_exa = band->null_exa;
+
+	/* EXA hands over pixmap coordinates, the images cover whole pixmaps */
+	pixman_image_composite32(null_exa->op, null_exa->srcImage,
+			null_exa->maskImage, null_exa->dstImage,
+			band->srcX, band->srcY + y1 - band->dstY,
+			band->maskX, band->maskY + y1 - band->dstY,
+			band->dstX, y1, band->width, y2 - y1);
+}
+
+static void
+Composite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
+		int dstX, int dstY, int width, int height)
+{
+	NullBandRec band = {
+			.null_exa = NullEXAPTR(pDst),
+			.srcX = srcX,
+			.srcY = srcY,
+			.maskX = maskX,
+			.maskY = maskY,
+			.dstX = dstX,
+			.dstY = dstY,
+			.width = width,
+	};
+
+	if (band.null_exa->inplace)
+		CompositeBand(&band, dstY, dstY + height);
+	else
+		OMAPBandsRun(pDst->drawable.pScreen, CompositeBand, &band,
+				dstY, dstY + height, width);
+}
+
+static void
+DoneComposite(PixmapPtr pDst)
+{
+	FreeImages(NullEXAPTR(pDst));
+	FlushPixmap(pDst);
 }
 
 static Bool
@@ -128,11 +433,19 @@ InitNullEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 	exa->FinishAccess = OMAPFinishAccess;
 	exa->PixmapIsOffscreen = OMAPPixmapIsOffscreen;
 
-	// Always fallback for software operations
-	exa->PrepareCopy = PrepareCopyFail;
-	exa->PrepareSolid = PrepareSolidFail;
-	exa->CheckComposite = CheckCompositeFail;
-	exa->PrepareComposite = PrepareCompositeFail;
+	// Software operations, without EXA's fallback overhead
+	exa->PrepareSolid = PrepareSolid;
+	exa->Solid = Solid;
+	exa->DoneSolid = DoneSolid;
+
+	exa->PrepareCopy = PrepareCopy;
+	exa->Copy = Copy;
+	exa->DoneCopy = DoneCopy;
+
+	exa->CheckComposite = CheckComposite;
+	exa->PrepareComposite = PrepareComposite;
+	exa->Composite = Composite;
+	exa->DoneComposite = DoneComposite;
 
 	if (! exaDriverInit(pScreen, exa)) {
 		ERROR_MSG("exaDriverInit failed");
@@ -22,11 +22,16 @@
 #endif
 
 #include <dlfcn.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 
 #include <exa.h>
+#include <dixstruct.h>
 #include <gc.h>
 #include <list.h>
+#include <pixman.h>
 
 #include <pvr_debug.h>
 
@@ -38,19 +43,41 @@
 #include "omap_pvr_use.h"
 #include "omap_pvr_sgx.h"
 
-#define PVR_MAX_BO_MAPS 32
-/* semi-arbitrary value, maybe add new parameter */
-#define PVR_BO_CACHE_SIZE 4 * 1024 * 1024
+/* part of the general heap BO mappings may use, the rest is fragmentation */
+#define PVR_MAP_HEAP_PERCENT 75
+/* part of RLIMIT_NOFILE kept open as exported BO fds, clients need the rest */
+#define PVR_FD_CACHE_PERCENT 25
+/* BO cache budget never drops below that while there is demand */
+#define PVR_BO_CACHE_MIN_SIZE (1024 * 1024)
 
 /* #define INSTRUMENT_BO_MAP */
-
-/* seems to be slower, also, transparency is broken */
-/* #define USE_HW_COMPOSITING */
+/* #define INSTRUMENT_SW_FILL */
 
 static PVRSolidOp gsSolidOp;
 static PVRCopyOp gsCopy2DOp;
 static PVRRenderOp gsRenderOp;
 
+/* ROPs for which filling a pixel twice is the same as filling it once */
+static const Bool sgxRopIdempotent[16] =
+{
+	TRUE,	/* GXclear */
+	TRUE,	/* GXand */
+	FALSE,	/* GXandReverse */
+	TRUE,	/* GXcopy */
+	TRUE,	/* GXandInverted */
+	TRUE,	/* GXnoop */
+	FALSE,	/* GXxor */
+	TRUE,	/* GXor */
+	FALSE,	/* GXnor */
+	FALSE,	/* GXequiv */
+	FALSE,	/* GXinvert */
+	FALSE,	/* GXorReverse */
+	TRUE,	/* GXcopyInverted */
+	TRUE,	/* GXorInverted */
+	FALSE,	/* GXnand */
+	TRUE	/* GXset */
+};
+
 static Bool
 copy2d(int bitsPerPixel)
 {
@@ -155,30 +182,82 @@ waitForBlitsCompleteOnDeviceMem(PixmapPtr pPixmap)
 	}
 }
 
+static Bool sgxUnmapFlush(ScreenPtr pScreen, PVRPtr pPVR, Bool wait);
+static unsigned int sgxCompareImages(pixman_image_t *image, int x, int y,
+				     pixman_image_t *shadow,
+				     PictFormatShort format, int width,
+				     int height, int tolerance);
+
+/*
+ * Has the GPU retired the ops queued on the BO?  Services count the ops
+ * submitted and completed in the sync object of every mapping, so this
+ * is a look at two counters rather than a call into PVR2D.  The CPU may
+ * read while the GPU still reads, writing has to wait for both.  The
+ * mapping of an evicted BO sits in the unmap queue until the GPU is done
+ * with it, its ops are only known to be retired once that is empty.
+ */
+static Bool
+sgxPixmapRetired(PVRPtr pPVR, PrivPixmapPtr priv, Bool write)
+{
+	PPVRSRV_CLIENT_MEM_INFO psMemInfo = priv->meminfo.hPrivateData;
+	volatile PVRSRV_SYNC_DATA *psSyncData;
+
+	if (!psMemInfo)
+		return !priv->evicted || !pPVR->unmap_count;
+
+	if (!psMemInfo->psClientSyncInfo)
+		return TRUE;
+
+	psSyncData = psMemInfo->psClientSyncInfo->psSyncData;
+
+	if (psSyncData->ui32WriteOpsComplete !=
+	    psSyncData->ui32WriteOpsPending)
+		return FALSE;
+
+	return !write || psSyncData->ui32ReadOpsComplete ==
+			 psSyncData->ui32ReadOpsPending;
+}
+
+/* wait until the CPU may read, or with write set also write, the pixmap */
 static void
-sgxWaitPixmap(PixmapPtr pPixmap)
+sgxWaitPixmap(PixmapPtr pPixmap, Bool write)
 {
 	OMAPPixmapPrivPtr pixmapPriv;
 	PrivPixmapPtr priv;
 	ScrnInfoPtr pScrn;
 	OMAPPtr pOMAP;
+	PVRPtr pPVR;
 
 	if (!pPixmap)
 		return;
 
 	pScrn = pix2scrn(pPixmap);
 	pOMAP = OMAPPTR(pScrn);
+	pPVR = PVREXAPTR(pScrn);
 	pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
 	priv = pixmapPriv->priv;
 
-	if (priv) {
-		if (priv->is_gpu &&
-		    (pixmapPriv->bo != pOMAP->scanout || pOMAP->ManualUpdate)) {
-			waitForBlitsCompleteOnDeviceMem(pPixmap);
-		}
+	if (!priv || sgxPixmapRetired(pPVR, priv, write))
+		return;
 
-		priv->is_gpu = FALSE;
-	}
+	/* tearing on the scanout is fine unless it is pushed by hand */
+	if (pixmapPriv->bo == pOMAP->scanout && !pOMAP->ManualUpdate)
+		return;
+
+	if (priv->meminfo.hPrivateData)
+		waitForBlitsCompleteOnDeviceMem(pPixmap);
+	else
+		sgxUnmapFlush(pPixmap->drawable.pScreen, pPVR, TRUE);
+}
+
+/* has the GPU finished with the pixmap? does not wait */
+static Bool
+sgxPixmapIdle(PVRPtr pPVR, PixmapPtr pPixmap, Bool write)
+{
+	OMAPPixmapPrivPtr pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
+	PrivPixmapPtr priv = pixmapPriv->priv;
+
+	return !priv || sgxPixmapRetired(pPVR, priv, write);
 }
 
 void
@@ -189,18 +268,50 @@ flushScanout(PixmapPtr pPixmap)
 	OMAPPtr pOMAP = OMAPPTR(pScrn);
 
 	if (pOMAP->ManualUpdate && pixmapPriv->bo == pOMAP->scanout) {
-		sgxWaitPixmap(pPixmap);
+		sgxWaitPixmap(pPixmap, FALSE);
 		drmmode_flush_scanout(pScrn);
 	}
 }
 
-void
-setPixmapOnGPU(PixmapPtr pPixmap)
+/* scanout updates are pushed to the display once per queue flush */
+static void
+sgxQueueScanout(PVRPtr pPVR, PixmapPtr pPixmap)
 {
+	ScrnInfoPtr pScrn = pix2scrn(pPixmap);
 	OMAPPixmapPrivPtr pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
-	PrivPixmapPtr priv = pixmapPriv->priv;
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
 
-	priv->is_gpu = TRUE;
+	if (pOMAP->ManualUpdate && pixmapPriv->bo == pOMAP->scanout)
+		pPVR->scanout_dirty = pPixmap;
+}
+
+/* does the queued batch or scanout flush refer to the pixmap? */
+static Bool
+sgxQueueUses(PVRPtr pPVR, OMAPPixmapPrivPtr pixmapPriv)
+{
+	PixmapPtr pPixmap[2] = { NULL, NULL };
+	int i;
+
+	switch (pPVR->queued) {
+		case PVR_QUEUE_SOLID:
+			pPixmap[0] = gsSolidOp.pPixmap;
+			break;
+		case PVR_QUEUE_COPY:
+			pPixmap[0] = gsCopy2DOp.renderOp.pSrc;
+			pPixmap[1] = gsCopy2DOp.renderOp.pDest;
+			break;
+		default:
+			break;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (pPixmap[i] &&
+		    exaGetPixmapDriverPrivate(pPixmap[i]) == pixmapPriv)
+			return TRUE;
+	}
+
+	return pPVR->scanout_dirty &&
+	       exaGetPixmapDriverPrivate(pPVR->scanout_dirty) == pixmapPriv;
 }
 
 static void
@@ -211,17 +322,184 @@ sgxAccelDestroy(ScreenPtr pScreen, PVRPtr pPVR)
 }
 
 static void
-sgxCacheInit(PVRPtr pPVR)
+sgxCacheInit(ScrnInfoPtr pScrn, PVRPtr pPVR)
 {
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
+	struct rlimit rlim;
+	int i;
+
 	xorg_list_init(&pPVR->map_list);
 	pPVR->map_count = 0;
+	pPVR->map_size = 0;
+	pPVR->map_max_size = pOMAP->GPUMapSize > 0 ?
+			(unsigned long)pOMAP->GPUMapSize * 1024 : 0;
+	pPVR->map_hit = 0;
+	pPVR->map_miss = 0;
+	pPVR->map_remap = 0;
+	pPVR->sw_fills = 0;
+	pPVR->unmap_count = 0;
+	pPVR->queued = PVR_QUEUE_NONE;
+	pPVR->scanout_dirty = NULL;
+	xorg_list_init(&pPVR->slab_list);
+	pPVR->slab_count = 0;
+	xorg_list_init(&pPVR->solid_list);
+	pPVR->solid_count = 0;
+	OMAPPoolInit(&pPVR->priv_pool, sizeof(PrivPixmapRec), 1024);
+	OMAPPoolInit(&pPVR->entry_pool, sizeof(BoCacheEntryRec), 1024);
+	xorg_list_init(&pPVR->fd_list);
+	pPVR->fd_count = 0;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) || rlim.rlim_cur == RLIM_INFINITY)
+		pPVR->fd_max = 256;
+	else
+		pPVR->fd_max = rlim.rlim_cur / 100 * PVR_FD_CACHE_PERCENT;
+
 	xorg_list_init(&pPVR->bo_list);
+
+	for (i = 0; i < ARRAY_SIZE(pPVR->bo_bucket); i++)
+		xorg_list_init(&pPVR->bo_bucket[i]);
+
+	memset(pPVR->bo_bucket_mask, 0, sizeof(pPVR->bo_bucket_mask));
 	pPVR->bo_count = 0;
 	pPVR->bo_size = 0;
-#ifdef INSTRUMENT_BO_CACHE
+
+	pPVR->bo_max_size = pOMAP->BoCacheSize > 0 ?
+				    (unsigned long)pOMAP->BoCacheSize * 1024 : 0;
+	pPVR->bo_timeout = pOMAP->BoCacheTimeout > 0 ?
+				   pOMAP->BoCacheTimeout : 0;
+	pPVR->bo_budget = 0;
+	pPVR->bo_demand = 0;
+	pPVR->bo_demand_time = GetTimeInMillis();
+
+	if (pOMAP->BoCacheTolerance < 0)
+		pPVR->bo_tolerance = 0;
+	else if (pOMAP->BoCacheTolerance > 100)
+		pPVR->bo_tolerance = 100;
+	else
+		pPVR->bo_tolerance = pOMAP->BoCacheTolerance;
+
 	pPVR->bo_cache_hit = 0;
 	pPVR->bo_cache_miss = 0;
-#endif
+	pPVR->bo_cache_waste = 0;
+
+	xorg_list_init(&pPVR->sbo_list);
+	pPVR->sbo_count = 0;
+	pPVR->sbo_size = 0;
+	pPVR->sbo_max_size = pOMAP->BoCacheSpecialSize > 0 ?
+			(unsigned long)pOMAP->BoCacheSpecialSize * 1024 : 0;
+}
+
+/* Render op names of the HWComposite option, indexed by op */
+static const char *const sgxCompositeOpNames[PictOpSaturate + 1] = {
+	"clear", "src", "dst", "over", "overreverse", "in", "inreverse",
+	"out", "outreverse", "atop", "atopreverse", "xor", "add", "saturate"
+};
+
+/*
+ * Parse the HWComposite option, a list of op[:format] entries.  The GPU
+ * path is slower than pixman for some ops and wrong for others, so
+ * nothing is composited on the GPU unless asked for.
+ */
+static void
+sgxCompositeInit(ScrnInfoPtr pScrn, PVRPtr pPVR)
+{
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
+	char *list, *entry, *save;
+	int op;
+
+	memset(pPVR->hw_composite, 0, sizeof(pPVR->hw_composite));
+	pPVR->composite_check = pOMAP->HWCompositeCheck;
+	pPVR->check_count = 0;
+	pPVR->check_mismatch = 0;
+
+	if (!pOMAP->HWComposite)
+		return;
+
+	list = strdup(pOMAP->HWComposite);
+	if (!list)
+		return;
+
+	for (entry = strtok_r(list, ", ", &save); entry;
+	     entry = strtok_r(NULL, ", ", &save)) {
+		char *format = strchr(entry, ':');
+		unsigned int classes = PVR_COMPOSITE_ALL;
+		Bool found = FALSE;
+
+		if (format) {
+			*format++ = '\0';
+
+			if (!strcasecmp(format, "a8"))
+				classes = PVR_COMPOSITE_A8;
+			else if (!strcasecmp(format, "xrgb"))
+				classes = PVR_COMPOSITE_XRGB;
+			else if (!strcasecmp(format, "argb"))
+				classes = PVR_COMPOSITE_ARGB;
+			else if (!strcasecmp(format, "rgb565"))
+				classes = PVR_COMPOSITE_RGB565;
+			else
+				classes = 0;
+		}
+
+		for (op = 0; op < ARRAY_SIZE(sgxCompositeOpNames); op++) {
+			if (strcasecmp(entry, "all") &&
+			    strcasecmp(entry, sgxCompositeOpNames[op]))
+				continue;
+
+			pPVR->hw_composite[op] |= classes;
+			found = TRUE;
+		}
+
+		if (!found || !classes)
+			WARNING_MSG("HWComposite: ignoring unknown entry %s%s%s",
+				    entry, format ? ":" : "",
+				    format ? format : "");
+	}
+
+	free(list);
+
+	for (op = 0; op < ARRAY_SIZE(sgxCompositeOpNames); op++) {
+		if (pPVR->hw_composite[op])
+			INFO_MSG("HW composite %s:%s%s%s%s",
+				 sgxCompositeOpNames[op],
+				 pPVR->hw_composite[op] & PVR_COMPOSITE_ARGB ?
+				 " argb" : "",
+				 pPVR->hw_composite[op] & PVR_COMPOSITE_XRGB ?
+				 " xrgb" : "",
+				 pPVR->hw_composite[op] & PVR_COMPOSITE_RGB565 ?
+				 " rgb565" : "",
+				 pPVR->hw_composite[op] & PVR_COMPOSITE_A8 ?
+				 " a8" : "");
+	}
+}
+
+static Bool
+sgxCompositeEnabled(PVRPtr pPVR, int op, PictFormatShort format)
+{
+	unsigned int class;
+
+	if (op < 0 || op >= ARRAY_SIZE(pPVR->hw_composite))
+		return FALSE;
+
+	switch (format) {
+	case PICT_a8:
+		class = PVR_COMPOSITE_A8;
+		break;
+	case PICT_x8r8g8b8:
+	case PICT_x8b8g8r8:
+		class = PVR_COMPOSITE_XRGB;
+		break;
+	case PICT_a8r8g8b8:
+	case PICT_a8b8g8r8:
+		class = PVR_COMPOSITE_ARGB;
+		break;
+	case PICT_r5g6b5:
+		class = PVR_COMPOSITE_RGB565;
+		break;
+	default:
+		return FALSE;
+	}
+
+	return (pPVR->hw_composite[op] & class) != 0;
 }
 
 static void
@@ -233,30 +511,94 @@ sgxMapRemove(ScreenPtr pScreen, PVRPtr pPVR, PrivPixmapPtr pvrPixmapPriv)
 		return;
 
 	pPVR->map_count--;
+	pPVR->map_size -= pvrPixmapPriv->meminfo.ui32MemSize;
 	xorg_list_del(&pvrPixmapPriv->map);
 
 	DEBUG_MSG("Mappings entry %p removed, list size %lu",
 		  pvrPixmapPriv, pPVR->map_count);
 }
 
+/*
+ * Unmap queued mappings, if wait is FALSE only those the GPU is done with.
+ * Returns TRUE if anything was unmapped.
+ */
+static Bool
+sgxUnmapFlush(ScreenPtr pScreen, PVRPtr pPVR, Bool wait)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < pPVR->unmap_count; i++) {
+		PPVR2DMEMINFO meminfo = &pPVR->unmap_queue[i];
+
+		if (PVR2DQueryBlitsComplete(pPVR->srv->hPVR2DContext, meminfo,
+					    wait) == PVR2DERROR_BLT_NOTCOMPLETE) {
+			pPVR->unmap_queue[count++] = *meminfo;
+			continue;
+		}
+
+		PVRUnMapBo(pScreen, pPVR->srv, meminfo);
+	}
+
+	i = pPVR->unmap_count;
+	pPVR->unmap_count = count;
+
+	return count != i;
+}
+
+/*
+ * Unmapping may flush the GPU MMU, so it is not done while rendering but
+ * batched and done before the server goes to sleep.
+ */
 static void
-sgxMapUnmapLRU(ScreenPtr pScreen, PVRPtr pPVR)
+sgxUnmapDefer(ScreenPtr pScreen, PVRPtr pPVR, PPVR2DMEMINFO meminfo)
+{
+	if (pPVR->unmap_count == PVR_UNMAP_QUEUE_SIZE)
+		sgxUnmapFlush(pScreen, pPVR, TRUE);
+
+	pPVR->unmap_queue[pPVR->unmap_count++] = *meminfo;
+	meminfo->hPrivateData = NULL;
+}
+
+/*
+ * Unmap the least recently used mapping that is not pinned, returns FALSE
+ * if there is nothing left to unmap.  The operation being prepared holds
+ * pointers to the mappings it took, they stay too.
+ */
+static Bool
+sgxMapUnmapOne(ScreenPtr pScreen, PVRPtr pPVR)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	PrivPixmapPtr pvrPixmapPriv;
 
-	if (pPVR->map_count <= PVR_MAX_BO_MAPS)
-		return;
+	/* the queued batch holds pointers to mappings */
+	sgxQueueFlush(pScreen);
+
+	xorg_list_for_each_entry(pvrPixmapPriv, &pPVR->map_list, map) {
+		if (!pvrPixmapPriv->pinned &&
+		    pvrPixmapPriv->op != pPVR->op_serial)
+			break;
+	}
 
-	pvrPixmapPriv = xorg_list_first_entry(
-				&pPVR->map_list, PrivPixmapRec, map);
-	DEBUG_MSG("Mappings list is full, removing last entry");
+	if (&pvrPixmapPriv->map == &pPVR->map_list)
+		return FALSE;
+
+	DEBUG_MSG("Unmapping LRU entry %p, mapped %lu KiB",
+		  pvrPixmapPriv, pPVR->map_size / 1024);
 
 	sgxMapRemove(pScreen, pPVR, pvrPixmapPriv);
+	sgxUnmapDefer(pScreen, pPVR, &pvrPixmapPriv->meminfo);
+	pvrPixmapPriv->evicted = TRUE;
+
+	return TRUE;
+}
 
-	if (pvrPixmapPriv->meminfo.hPrivateData) {
-		PVRUnMapBo(pScreen, pPVR->srv, &pvrPixmapPriv->meminfo);
-		pvrPixmapPriv->meminfo.hPrivateData = NULL;
+/* make room for a new mapping of size bytes */
+static void
+sgxMapUnmapLRU(ScreenPtr pScreen, PVRPtr pPVR, unsigned long size)
+{
+	while (pPVR->map_size + size > pPVR->map_max_size) {
+		if (!sgxMapUnmapOne(pScreen, pPVR))
+			break;
 	}
 }
 
@@ -265,14 +607,92 @@ sgxMapMarkUsed(PVRPtr pPVR, PrivPixmapPtr pvrPixmapPriv)
 {
 	struct xorg_list *map = &pvrPixmapPriv->map;
 
-	if (map->next == map->prev && map->prev == map)
+	if (map->next == map->prev && map->prev == map) {
 		pPVR->map_count++;
-	else
+		pPVR->map_size += pvrPixmapPriv->meminfo.ui32MemSize;
+	} else
 		xorg_list_del(map);
 
 	xorg_list_append(map, &pPVR->map_list);
 }
 
+static void
+sgxFdClose(PVRPtr pPVR, PrivPixmapPtr pvrPixmapPriv)
+{
+	if (pvrPixmapPriv->fd < 0)
+		return;
+
+	close(pvrPixmapPriv->fd);
+	pvrPixmapPriv->fd = -1;
+	xorg_list_del(&pvrPixmapPriv->fd_list);
+	pPVR->fd_count--;
+}
+
+/*
+ * Exported fds are kept for the lifetime of the BO, so a remap after the
+ * mapping LRU dropped it does not need a PRIME ioctl.
+ */
+static int
+sgxFdGet(ScreenPtr pScreen, PVRPtr pPVR, PrivPixmapPtr pvrPixmapPriv,
+	 struct omap_bo *bo)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
+
+	if (pvrPixmapPriv->fd >= 0) {
+		xorg_list_del(&pvrPixmapPriv->fd_list);
+		xorg_list_append(&pvrPixmapPriv->fd_list, &pPVR->fd_list);
+		return pvrPixmapPriv->fd;
+	}
+
+	while (pPVR->fd_count && pPVR->fd_count >= pPVR->fd_max) {
+		sgxFdClose(pPVR, xorg_list_first_entry(&pPVR->fd_list,
+						       PrivPixmapRec,
+						       fd_list));
+	}
+
+	pvrPixmapPriv->fd = PVRExportBo(pScreen, pOMAP->drmFD, bo);
+
+	if (pvrPixmapPriv->fd < 0)
+		return -1;
+
+	xorg_list_append(&pvrPixmapPriv->fd_list, &pPVR->fd_list);
+	pPVR->fd_count++;
+
+	return pvrPixmapPriv->fd;
+}
+
+static void
+sgxFreePrivPixmap(PVRPtr pPVR, PrivPixmapPtr pvrPixmapPriv)
+{
+	sgxFdClose(pPVR, pvrPixmapPriv);
+	OMAPPoolFree(&pPVR->priv_pool, pvrPixmapPriv);
+}
+
+static PrivPixmapPtr
+sgxAllocPrivPixmap(PVRPtr pPVR)
+{
+	PrivPixmapPtr pvrPixmapPriv = OMAPPoolAlloc(&pPVR->priv_pool);
+
+	if (!pvrPixmapPriv)
+		return NULL;
+
+	xorg_list_init(&pvrPixmapPriv->map);
+	xorg_list_init(&pvrPixmapPriv->fd_list);
+	pvrPixmapPriv->fd = -1;
+
+	return pvrPixmapPriv;
+}
+
+static PrivPixmapPtr
+sgxGetPrivPixmap(PVRPtr pPVR, OMAPPixmapPrivPtr pixmapPriv)
+{
+	if (!pixmapPriv->priv)
+		pixmapPriv->priv = sgxAllocPrivPixmap(pPVR);
+
+	return pixmapPriv->priv;
+}
+
 PrivPixmapPtr
 sgxMapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
 {
@@ -280,13 +700,15 @@ sgxMapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
 	PrivPixmapPtr pvrPixmapPriv;
 	OMAPPtr pOMAP = OMAPPTR(pScrn);
 	PVRPtr pPVR = PVREXAPTR(pScrn);
+	int fd;
 
-	if (!pixmapPriv->priv) {
-		pixmapPriv->priv = calloc(sizeof(PrivPixmapRec), 1);
-		xorg_list_init(&((PrivPixmapPtr)pixmapPriv->priv)->map);
-	}
+	pvrPixmapPriv = sgxGetPrivPixmap(pPVR, pixmapPriv);
+
+	if (!pvrPixmapPriv)
+		return NULL;
 
-	pvrPixmapPriv = pixmapPriv->priv;
+	pvrPixmapPriv->pinned = pixmapPriv->pinned > 0;
+	pvrPixmapPriv->op = pPVR->op_serial;
 
 	if (!pvrPixmapPriv->meminfo.hPrivateData) {
 #ifdef INSTRUMENT_BO_MAP
@@ -294,21 +716,44 @@ sgxMapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
 
 		gettimeofday(&start, NULL);
 #endif
-		sgxMapUnmapLRU(pScreen, pPVR);
+		sgxMapUnmapLRU(pScreen, pPVR, omap_bo_size(pixmapPriv->bo));
 
-		if (!PVRMapBo(pScreen, pPVR->srv, pOMAP->drmFD, pixmapPriv->bo,
-			      &pvrPixmapPriv->meminfo)) {
-			free(pvrPixmapPriv);
-			pixmapPriv->priv = NULL;
+		/*
+		 * The heap might be fragmented or used by someone else too,
+		 * unmap more until the BO fits.
+		 * Keep the (unmapped) private, it holds the BO cache key.
+		 */
+		fd = sgxFdGet(pScreen, pPVR, pvrPixmapPriv, pixmapPriv->bo);
+
+		if (fd < 0)
 			return NULL;
+
+		while (!PVRMapBo(pScreen, pPVR->srv, fd, pixmapPriv->bo,
+				 &pvrPixmapPriv->meminfo)) {
+			pvrPixmapPriv->meminfo.hPrivateData = NULL;
+
+			if (!sgxUnmapFlush(pScreen, pPVR, TRUE) &&
+			    !sgxMapUnmapOne(pScreen, pPVR)) {
+				return NULL;
+			}
+		}
+
+		pPVR->map_miss++;
+
+		if (pvrPixmapPriv->evicted) {
+			pPVR->map_remap++;
+			pvrPixmapPriv->evicted = FALSE;
 		}
 #ifdef INSTRUMENT_BO_MAP
 		gettimeofday(&stop, NULL);
-		DEBUG_MSG("PVRMapBo took %lu us",
+		DEBUG_MSG("PVRMapBo took %lu us, mapped %lu KiB in %lu BOs, remapped %lu of %lu",
 			  (stop.tv_sec - start.tv_sec) * 1000000 +
-			  stop.tv_usec - start.tv_usec);
+			  stop.tv_usec - start.tv_usec,
+			  pPVR->map_size / 1024, pPVR->map_count,
+			  pPVR->map_remap, pPVR->map_hit + pPVR->map_miss);
 #endif
-	}
+	} else
+		pPVR->map_hit++;
 
 	/*
 	 * We have to keep a pointer, as otherwise we cannot unmap in
@@ -322,6 +767,187 @@ sgxMapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
 	return pvrPixmapPriv;
 }
 
+static inline Bool
+sgxPixmapInSlab(OMAPPixmapPrivPtr pixmapPriv)
+{
+	PrivPixmapPtr pvrPixmapPriv = pixmapPriv->priv;
+
+	return pvrPixmapPriv && pvrPixmapPriv->slab;
+}
+
+/*
+ * Mappings taken from now on are used by a new operation, the ones of the
+ * previous operation may be unmapped again.
+ */
+void
+sgxMapOpBegin(ScreenPtr pScreen)
+{
+	PVRPtr pPVR = PVREXAPTR(xf86ScreenToScrn(pScreen));
+
+	pPVR->op_serial++;
+}
+
+/* slabs are shared, DRI2 moves its pixmaps to BOs of their own first */
+static void
+sgxPixmapPinned(PixmapPtr pPixmap)
+{
+	OMAPPixmapPrivPtr pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
+	PrivPixmapPtr pvrPixmapPriv = pixmapPriv->priv;
+
+	if (pvrPixmapPriv && !pvrPixmapPriv->slab)
+		pvrPixmapPriv->pinned = pixmapPriv->pinned > 0;
+}
+
+static PVRSlabPtr
+sgxSlabCreate(ScreenPtr pScreen, PVRPtr pPVR)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
+	PVRSlabPtr slab = calloc(sizeof(PVRSlabRec), 1);
+
+	if (!slab)
+		return NULL;
+
+	slab->bo = omap_bo_new(pOMAP->dev, PVR_SLAB_SIZE, OMAP_BO_WC);
+	slab->priv = sgxAllocPrivPixmap(pPVR);
+
+	if (!slab->bo || !slab->priv) {
+		omap_bo_del(slab->bo);
+		OMAPPoolFree(&pPVR->priv_pool, slab->priv);
+		free(slab);
+		return NULL;
+	}
+
+	slab->priv->slab = slab;
+	slab->free_chunks = PVR_SLAB_CHUNKS;
+	xorg_list_add(&slab->list, &pPVR->slab_list);
+	pPVR->slab_count++;
+
+	DEBUG_MSG("%s slab %p, bo %p, slabs count %lu",
+		  __func__, slab, slab->bo, pPVR->slab_count);
+
+	return slab;
+}
+
+static void
+sgxSlabDestroy(ScreenPtr pScreen, PVRPtr pPVR, PVRSlabPtr slab)
+{
+	PrivPixmapPtr priv = slab->priv;
+
+	if (priv->meminfo.hPrivateData) {
+		sgxMapRemove(pScreen, pPVR, priv);
+		sgxUnmapDefer(pScreen, pPVR, &priv->meminfo);
+	}
+
+	sgxFreePrivPixmap(pPVR, priv);
+	omap_bo_del(slab->bo);
+	xorg_list_del(&slab->list);
+	pPVR->slab_count--;
+	free(slab);
+}
+
+static void
+sgxSlabMark(PVRSlabPtr slab, unsigned int first, unsigned int n, Bool used)
+{
+	unsigned int i;
+
+	for (i = first; i < first + n; i++) {
+		if (used)
+			slab->used[i / 32] |= 1U << (i % 32);
+		else
+			slab->used[i / 32] &= ~(1U << (i % 32));
+	}
+
+	slab->len[first] = used ? n : 0;
+}
+
+/* first fit, returns the first chunk of n free ones or -1 */
+static int
+sgxSlabFind(PVRSlabPtr slab, unsigned int n)
+{
+	unsigned int i, run = 0;
+
+	for (i = 0; i < PVR_SLAB_CHUNKS; i++) {
+		if (slab->used[i / 32] & (1U << (i % 32)))
+			run = 0;
+		else if (++run == n)
+			return i + 1 - n;
+	}
+
+	return -1;
+}
+
+static Bool
+sgxSlabAlloc(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv, uint32_t size)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+	unsigned int n = (size + PVR_SLAB_CHUNK - 1) / PVR_SLAB_CHUNK;
+	PVRSlabPtr slab;
+	int first = -1;
+
+	xorg_list_for_each_entry(slab, &pPVR->slab_list, list) {
+		if (slab->free_chunks < n)
+			continue;
+
+		first = sgxSlabFind(slab, n);
+
+		if (first >= 0)
+			break;
+	}
+
+	if (first < 0) {
+		slab = sgxSlabCreate(pScreen, pPVR);
+
+		if (!slab)
+			return FALSE;
+
+		first = 0;
+	}
+
+	sgxSlabMark(slab, first, n, TRUE);
+	slab->free_chunks -= n;
+
+	pixmapPriv->bo = slab->bo;
+	pixmapPriv->priv = slab->priv;
+	pixmapPriv->offset = first * PVR_SLAB_CHUNK;
+	pixmapPriv->flags = OMAP_BO_WC;
+	pixmapPriv->tiled = FALSE;
+
+	return TRUE;
+}
+
+static Bool
+sgxSlabFits(OMAPPixmapPrivPtr pixmapPriv, uint32_t size)
+{
+	PrivPixmapPtr pvrPixmapPriv = pixmapPriv->priv;
+	unsigned int first = pixmapPriv->offset / PVR_SLAB_CHUNK;
+
+	return size <= pvrPixmapPriv->slab->len[first] * PVR_SLAB_CHUNK;
+}
+
+/* gives the chunks of the pixmap back, the pixmap is left without a BO */
+static void
+sgxSlabFree(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+	PrivPixmapPtr pvrPixmapPriv = pixmapPriv->priv;
+	PVRSlabPtr slab = pvrPixmapPriv->slab;
+	unsigned int first = pixmapPriv->offset / PVR_SLAB_CHUNK;
+
+	slab->free_chunks += slab->len[first];
+	sgxSlabMark(slab, first, slab->len[first], FALSE);
+
+	pixmapPriv->bo = NULL;
+	pixmapPriv->priv = NULL;
+	pixmapPriv->offset = 0;
+
+	/* keep one empty slab around */
+	if (slab->free_chunks == PVR_SLAB_CHUNKS && pPVR->slab_count > 1)
+		sgxSlabDestroy(pScreen, pPVR, slab);
+}
+
 void
 sgxUnmapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
 {
@@ -329,6 +955,12 @@ sgxUnmapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	PVRPtr pPVR = PVREXAPTR(pScrn);
 
+	/* the mapping is shared, only drop the pixmap storage */
+	if (sgxPixmapInSlab(pixmapPriv)) {
+		sgxSlabFree(pScreen, pixmapPriv);
+		return;
+	}
+
 	if (pvrPixmapPriv) {
 		if (pPVR->scanout_priv == pvrPixmapPriv)
 			pPVR->scanout_priv = NULL;
@@ -336,13 +968,49 @@ sgxUnmapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
 			sgxMapRemove(pScreen, pPVR, pvrPixmapPriv);
 
 		if (pvrPixmapPriv->meminfo.hPrivateData)
-			PVRUnMapBo(pScreen, pPVR->srv, &pvrPixmapPriv->meminfo);
+			sgxUnmapDefer(pScreen, pPVR, &pvrPixmapPriv->meminfo);
 
-		free(pvrPixmapPriv);
+		sgxFreePrivPixmap(pPVR, pvrPixmapPriv);
 		pixmapPriv->priv = NULL;
 	}
 }
 
+static inline unsigned int
+sgxBoCacheBucket(uint32_t pages)
+{
+	if (pages > PVR_BO_CACHE_BUCKETS)
+		return PVR_BO_CACHE_BUCKETS;
+
+	return pages - 1;
+}
+
+static void
+sgxBoCacheLink(PVRPtr pPVR, BoCacheEntryPtr entry)
+{
+	unsigned int idx = sgxBoCacheBucket(entry->pages);
+
+	xorg_list_append(&entry->list, &pPVR->bo_list);
+	xorg_list_append(&entry->bucket, &pPVR->bo_bucket[idx]);
+	pPVR->bo_bucket_mask[idx / 32] |= 1U << (idx % 32);
+	pPVR->bo_count++;
+	pPVR->bo_size += omap_bo_size(entry->bo);
+}
+
+static void
+sgxBoCacheUnlink(PVRPtr pPVR, BoCacheEntryPtr entry)
+{
+	unsigned int idx = sgxBoCacheBucket(entry->pages);
+
+	xorg_list_del(&entry->list);
+	xorg_list_del(&entry->bucket);
+
+	if (xorg_list_is_empty(&pPVR->bo_bucket[idx]))
+		pPVR->bo_bucket_mask[idx / 32] &= ~(1U << (idx % 32));
+
+	pPVR->bo_count--;
+	pPVR->bo_size -= omap_bo_size(entry->bo);
+}
+
 static void
 sgxBoCacheRemove(ScreenPtr pScreen, PVRPtr pPVR, BoCacheEntryPtr entry)
 {
@@ -350,15 +1018,103 @@ sgxBoCacheRemove(ScreenPtr pScreen, PVRPtr pPVR, BoCacheEntryPtr entry)
 
 	if (priv && priv->meminfo.hPrivateData) {
 		sgxMapRemove(pScreen, pPVR, priv);
-		PVRUnMapBo(pScreen, pPVR->srv, &priv->meminfo);
+		sgxUnmapDefer(pScreen, pPVR, &priv->meminfo);
 	}
 
-	free(entry->priv);
-	pPVR->bo_size -= omap_bo_size(entry->bo);
-	pPVR->bo_count--;
+	sgxFreePrivPixmap(pPVR, entry->priv);
+	sgxBoCacheUnlink(pPVR, entry);
 	omap_bo_del(entry->bo);
-	xorg_list_del(&entry->list);
-	free(entry);
+	OMAPPoolFree(&pPVR->entry_pool, entry);
+}
+
+/* first non-empty bucket in [first, last] or -1 */
+static int
+sgxBoCacheNextBucket(PVRPtr pPVR, unsigned int first, unsigned int last)
+{
+	unsigned int idx = first;
+
+	while (idx <= last) {
+		uint32_t word = pPVR->bo_bucket_mask[idx / 32] >> (idx % 32);
+
+		if (word) {
+			idx += ffs(word) - 1;
+			return idx <= last ? idx : -1;
+		}
+
+		idx = (idx | 31) + 1;
+	}
+
+	return -1;
+}
+
+static BoCacheEntryPtr
+sgxBoCacheFind(PVRPtr pPVR, uint32_t pages)
+{
+	uint32_t max_pages = pages + pages * pPVR->bo_tolerance / 100;
+	BoCacheEntryPtr entry, best = NULL;
+
+	if (!pages)
+		return NULL;
+
+	if (pages <= PVR_BO_CACHE_BUCKETS) {
+		unsigned int last = max_pages;
+		int idx;
+
+		if (last > PVR_BO_CACHE_BUCKETS)
+			last = PVR_BO_CACHE_BUCKETS;
+
+		idx = sgxBoCacheNextBucket(pPVR, pages - 1, last - 1);
+
+		if (idx >= 0) {
+			return xorg_list_first_entry(&pPVR->bo_bucket[idx],
+						     BoCacheEntryRec, bucket);
+		}
+
+		if (max_pages <= PVR_BO_CACHE_BUCKETS)
+			return NULL;
+	}
+
+	/* big BOs share the overflow bucket, look for the best fit there */
+	xorg_list_for_each_entry(entry, &pPVR->bo_bucket[PVR_BO_CACHE_BUCKETS],
+				 bucket) {
+		if (entry->pages < pages || entry->pages > max_pages)
+			continue;
+
+		if (!best || entry->pages < best->pages) {
+			best = entry;
+
+			if (best->pages == pages)
+				break;
+		}
+	}
+
+	return best;
+}
+
+static void
+sgxBoCacheUpdateBudget(PVRPtr pPVR)
+{
+	unsigned long budget = pPVR->bo_demand;
+
+	if (budget < PVR_BO_CACHE_MIN_SIZE)
+		budget = PVR_BO_CACHE_MIN_SIZE;
+
+	if (budget > pPVR->bo_max_size)
+		budget = pPVR->bo_max_size;
+
+	pPVR->bo_budget = budget;
+}
+
+static void
+sgxBoCacheTrim(ScreenPtr pScreen, PVRPtr pPVR)
+{
+	BoCacheEntryPtr entry;
+
+	while (pPVR->bo_size > pPVR->bo_budget) {
+		entry = xorg_list_first_entry(&pPVR->bo_list, BoCacheEntryRec,
+					      list);
+		sgxBoCacheRemove(pScreen, pPVR, entry);
+	}
 }
 
 static struct omap_bo *
@@ -366,37 +1122,37 @@ sgxBoCacheGet(ScreenPtr pScreen, uint32_t size, void **priv)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	PVRPtr pPVR = PVREXAPTR(pScrn);
-	BoCacheEntryPtr entry = NULL;
+	BoCacheEntryPtr entry;
+	struct omap_bo *bo;
 
 	size = (size + (4096 - 1)) & ~(4096 - 1);
+	pPVR->bo_demand += size;
 
 #ifdef INSTRUMENT_BO_CACHE
-	DEBUG_MSG("%s cache stats: hits %lu, misses %lu", __func__,
-		  pPVR->bo_cache_hit, pPVR->bo_cache_miss);
-#endif
-	xorg_list_for_each_entry(entry, &pPVR->bo_list, list) {
-		if (omap_bo_size(entry->bo) == size) {
-			struct omap_bo *bo = entry->bo;
-
-			*priv = entry->priv;
-			pPVR->bo_count--;
-			pPVR->bo_size -= omap_bo_size(bo);
-			xorg_list_del(&entry->list);
-			free(entry);
-			DEBUG_MSG("%s cache hit entries %lu, bo %p, block size %u",
-				  __func__, pPVR->bo_count, bo, size);
-#ifdef INSTRUMENT_BO_CACHE
-			pPVR->bo_cache_hit++;
+	DEBUG_MSG("%s cache stats: hits %lu, misses %lu, waste %llu KiB",
+		  __func__, pPVR->bo_cache_hit, pPVR->bo_cache_miss,
+		  pPVR->bo_cache_waste / 1024);
 #endif
-			return bo;
-		}
+	entry = sgxBoCacheFind(pPVR, size / 4096);
+
+	if (!entry) {
+		DEBUG_MSG("%s cache miss for size %u", __func__, size);
+		pPVR->bo_cache_miss++;
+		return NULL;
 	}
 
-	DEBUG_MSG("%s cache miss for size %u", __func__, size);
-#ifdef INSTRUMENT_BO_CACHE
-	pPVR->bo_cache_miss++;
-#endif
-	return NULL;
+	bo = entry->bo;
+	*priv = entry->priv;
+	sgxBoCacheUnlink(pPVR, entry);
+	OMAPPoolFree(&pPVR->entry_pool, entry);
+
+	pPVR->bo_cache_hit++;
+	pPVR->bo_cache_waste += omap_bo_size(bo) - size;
+
+	DEBUG_MSG("%s cache hit entries %lu, bo %p, block size %u, bo size %u",
+		  __func__, pPVR->bo_count, bo, size, omap_bo_size(bo));
+
+	return bo;
 }
 
 static Bool
@@ -409,39 +1165,338 @@ sgxBoCachePut(ScreenPtr pScreen, struct omap_bo *bo, PrivPixmapPtr priv)
 	if (!bo)
 		return FALSE;
 
-	entry = calloc(sizeof(BoCacheEntryRec), 1);
+	entry = OMAPPoolAlloc(&pPVR->entry_pool);
+
+	if (!entry)
+		return FALSE;
+
+	/* plain BOs may come from exchanged DRI2 buffers, forget the key */
+	if (priv) {
+		memset(&priv->key, 0, sizeof(priv->key));
+		priv->pinned = FALSE;
+	}
+
 	entry->bo = bo;
 	entry->priv = priv;
-	pPVR->bo_count++;
-	pPVR->bo_size += omap_bo_size(bo);
-	xorg_list_append(&entry->list, &pPVR->bo_list);
+	entry->pages = (omap_bo_size(bo) + (4096 - 1)) / 4096;
+	entry->time = GetTimeInMillis();
+	sgxBoCacheLink(pPVR, entry);
+
+	sgxBoCacheUpdateBudget(pPVR);
+	sgxBoCacheTrim(pScreen, pPVR);
+
+	DEBUG_MSG("%s bo %p put in cache, block size %u, entries count %lu, total %lu KiB, budget %lu KiB",
+		  __func__, bo, omap_bo_size(bo), pPVR->bo_count,
+		  pPVR->bo_size / 1024, pPVR->bo_budget / 1024);
+
+	return TRUE;
+}
+
+static inline Bool
+sgxBoCacheKeyEqual(const BoCacheKeyRec *a, const BoCacheKeyRec *b)
+{
+	return a->usage_hint == b->usage_hint && a->width == b->width &&
+	       a->height == b->height && a->bitsPerPixel == b->bitsPerPixel;
+}
+
+static void
+sgxSpecialBoCacheRemove(ScreenPtr pScreen, PVRPtr pPVR, BoCacheEntryPtr entry)
+{
+	PrivPixmapPtr priv = entry->priv;
+
+	if (priv->meminfo.hPrivateData) {
+		sgxMapRemove(pScreen, pPVR, priv);
+		sgxUnmapDefer(pScreen, pPVR, &priv->meminfo);
+	}
+
+	sgxFreePrivPixmap(pPVR, entry->priv);
+	xorg_list_del(&entry->list);
+	pPVR->sbo_count--;
+	pPVR->sbo_size -= omap_bo_size(entry->bo);
+	omap_bo_del(entry->bo);
+	OMAPPoolFree(&pPVR->entry_pool, entry);
+}
+
+/*
+ * Tiled, scanout and Xv BOs are only reused for a pixmap of exactly the
+ * same kind and dimensions, so stride and TILER layout match.
+ */
+static struct omap_bo *
+sgxSpecialBoCacheGet(ScreenPtr pScreen, const BoCacheKeyRec *key,
+		     void **priv, Bool *tiled)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+	BoCacheEntryPtr entry;
+
+	xorg_list_for_each_entry(entry, &pPVR->sbo_list, list) {
+		struct omap_bo *bo = entry->bo;
+
+		if (!sgxBoCacheKeyEqual(&entry->priv->key, key))
+			continue;
+
+		*priv = entry->priv;
+		*tiled = entry->tiled;
+		xorg_list_del(&entry->list);
+		pPVR->sbo_count--;
+		pPVR->sbo_size -= omap_bo_size(bo);
+		OMAPPoolFree(&pPVR->entry_pool, entry);
+
+		DEBUG_MSG("%s cache hit bo %p, %dx%d, usage 0x%x",
+			  __func__, bo, key->width, key->height,
+			  key->usage_hint);
+
+		return bo;
+	}
+
+	return NULL;
+}
+
+static Bool
+sgxSpecialBoCachePut(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+	PrivPixmapPtr priv = pixmapPriv->priv;
+	BoCacheEntryPtr entry;
+
+	if (!pixmapPriv->bo || pixmapPriv->bo == pOMAP->scanout)
+		return FALSE;
+
+	if (!priv || !priv->key.usage_hint)
+		return FALSE;
+
+	if (omap_bo_size(pixmapPriv->bo) > pPVR->sbo_max_size)
+		return FALSE;
+
+	entry = OMAPPoolAlloc(&pPVR->entry_pool);
+
+	if (!entry)
+		return FALSE;
+
+	priv->pinned = FALSE;
+
+	entry->bo = pixmapPriv->bo;
+	entry->priv = priv;
+	entry->tiled = pixmapPriv->tiled;
+	entry->time = GetTimeInMillis();
+	xorg_list_init(&entry->bucket);
+	xorg_list_append(&entry->list, &pPVR->sbo_list);
+	pPVR->sbo_count++;
+	pPVR->sbo_size += omap_bo_size(entry->bo);
+
+	while (pPVR->sbo_size > pPVR->sbo_max_size) {
+		entry = xorg_list_first_entry(&pPVR->sbo_list, BoCacheEntryRec,
+					      list);
+		sgxSpecialBoCacheRemove(pScreen, pPVR, entry);
+	}
+
+	DEBUG_MSG("%s bo %p put in cache, %dx%d, usage 0x%x, entries count %lu, total %lu KiB",
+		  __func__, pixmapPriv->bo, priv->key.width, priv->key.height,
+		  priv->key.usage_hint, pPVR->sbo_count, pPVR->sbo_size / 1024);
+
+	return TRUE;
+}
+
+typedef void (*BoCacheRemoveProc)(ScreenPtr pScreen, PVRPtr pPVR,
+				  BoCacheEntryPtr entry);
+
+static void
+sgxBoCacheExpire(ScreenPtr pScreen, PVRPtr pPVR, struct xorg_list *list,
+		 BoCacheRemoveProc remove, CARD32 now, pointer pTimeout)
+{
+	BoCacheEntryPtr entry;
+
+	while (!xorg_list_is_empty(list)) {
+		CARD32 age;
+
+		entry = xorg_list_first_entry(list, BoCacheEntryRec, list);
+		age = now - entry->time;
+
+		if (age < pPVR->bo_timeout) {
+			AdjustWaitForDelay(pTimeout, pPVR->bo_timeout - age);
+			break;
+		}
+
+		remove(pScreen, pPVR, entry);
+	}
+}
+
+/*
+ * Called before the server sleeps. Decays the demand estimate, drops BOs
+ * that were not reused for bo_timeout ms and makes sure we are woken up
+ * to drop the rest, so an idle server ends up with an empty cache.
+ */
+static void
+sgxBoCacheAge(ScreenPtr pScreen, PVRPtr pPVR, pointer pTimeout)
+{
+	CARD32 now = GetTimeInMillis();
+
+	while (pPVR->bo_demand &&
+	       (CARD32)(now - pPVR->bo_demand_time) >= pPVR->bo_timeout) {
+		pPVR->bo_demand >>= 1;
+		pPVR->bo_demand_time += pPVR->bo_timeout ? pPVR->bo_timeout :
+				       (now - pPVR->bo_demand_time);
+	}
+
+	if (!pPVR->bo_demand)
+		pPVR->bo_demand_time = now;
+
+	sgxBoCacheUpdateBudget(pPVR);
+	sgxBoCacheTrim(pScreen, pPVR);
+
+	sgxBoCacheExpire(pScreen, pPVR, &pPVR->bo_list, sgxBoCacheRemove, now,
+			 pTimeout);
+	sgxBoCacheExpire(pScreen, pPVR, &pPVR->sbo_list,
+			 sgxSpecialBoCacheRemove, now, pTimeout);
+}
+
+static void
+sgxSolidPictureDestroy(ScreenPtr pScreen, PVRPtr pPVR,
+		       PVRSolidPicturePtr solid)
+{
+	xorg_list_del(&solid->list);
+	pPVR->solid_count--;
+	FreePicture(solid->pPicture, 0);
+	pScreen->DestroyPixmap(solid->pPixmap);
+	free(solid);
+}
+
+static PVRSolidPicturePtr
+sgxSolidPictureCreate(ScreenPtr pScreen, PVRPtr pPVR, CARD32 color)
+{
+	PVRSolidPicturePtr solid;
+	OMAPPixmapPrivPtr priv;
+	PictFormatPtr pFormat;
+	XID repeat = RepeatNormal;
+	char *map;
+	int error;
+
+	pFormat = PictureMatchFormat(pScreen, 32, PICT_a8r8g8b8);
+
+	if (!pFormat)
+		return NULL;
+
+	solid = calloc(sizeof(PVRSolidPictureRec), 1);
+
+	if (!solid)
+		return NULL;
+
+	solid->pPixmap = pScreen->CreatePixmap(pScreen, 1, 1, 32, 0);
+
+	if (!solid->pPixmap)
+		goto err_free;
+
+	priv = exaGetPixmapDriverPrivate(solid->pPixmap);
+	map = priv && priv->bo ? omap_bo_map(priv->bo) : NULL;
+
+	if (!map)
+		goto err_pixmap;
+
+	solid->pPicture = CreatePicture(0, &solid->pPixmap->drawable, pFormat,
+					CPRepeat, &repeat, serverClient,
+					&error);
+
+	if (!solid->pPicture)
+		goto err_pixmap;
+
+	/* the chunk may have been used by a pixmap the GPU still reads */
+	sgxWaitPixmap(solid->pPixmap, TRUE);
+	*(CARD32 *)(map + priv->offset) = color;
+
+	solid->color = color;
+	xorg_list_append(&solid->list, &pPVR->solid_list);
+	pPVR->solid_count++;
+
+	return solid;
+
+err_pixmap:
+	pScreen->DestroyPixmap(solid->pPixmap);
+err_free:
+	free(solid);
+
+	return NULL;
+}
+
+/*
+ * Returns a 1x1 repeating picture for a solid fill picture, so it can be
+ * used as a composite source or mask. Returns NULL for any other picture.
+ */
+static PicturePtr
+sgxSolidPictureGet(ScreenPtr pScreen, PicturePtr pPicture)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+	PVRSolidPicturePtr solid;
+	CARD32 color;
+
+	if (pPicture->pDrawable || !pPicture->pSourcePict ||
+	    pPicture->pSourcePict->type != SourcePictTypeSolidFill) {
+		return NULL;
+	}
+
+	color = pPicture->pSourcePict->solidFill.color;
+
+	xorg_list_for_each_entry(solid, &pPVR->solid_list, list) {
+		if (solid->color == color) {
+			xorg_list_del(&solid->list);
+			xorg_list_append(&solid->list, &pPVR->solid_list);
+			return solid->pPicture;
+		}
+	}
 
-	while (pPVR->bo_size > PVR_BO_CACHE_SIZE) {
-		entry = xorg_list_first_entry(&pPVR->bo_list, BoCacheEntryRec,
-					      list);
-		sgxBoCacheRemove(pScreen, pPVR, entry);
+	if (pPVR->solid_count >= PVR_SOLID_CACHE_SIZE) {
+		solid = xorg_list_first_entry(&pPVR->solid_list,
+					      PVRSolidPictureRec, list);
+		sgxSolidPictureDestroy(pScreen, pPVR, solid);
 	}
 
-	DEBUG_MSG("%s bo %p put in cache, block size %u, entries count %lu, total %lu KiB",
-		  __func__, bo, omap_bo_size(bo), pPVR->bo_count,
-		  pPVR->bo_size / 1024);
+	solid = sgxSolidPictureCreate(pScreen, pPVR, color);
 
-	return TRUE;
+	return solid ? solid->pPicture : NULL;
 }
 
 static Bool
 CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 {
 	BoCacheEntryPtr entry, tmp;
+	PVRSlabPtr slab, slab_tmp;
+	PVRSolidPicturePtr solid, solid_tmp;
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	PVRPtr pPVR = PVREXAPTR(pScrn);
 	OMAPPtr pOMAP = OMAPPTR_FROM_SCREEN(pScreen);
 
+	sgxQueueFlush(pScreen);
+
+	xorg_list_for_each_entry_safe(solid, solid_tmp, &pPVR->solid_list,
+				      list) {
+		sgxSolidPictureDestroy(pScreen, pPVR, solid);
+	}
+
 	xorg_list_for_each_entry_safe(entry, tmp, &pPVR->bo_list, list)
 		sgxBoCacheRemove(pScreen, pPVR, entry);
 
+	xorg_list_for_each_entry_safe(entry, tmp, &pPVR->sbo_list, list)
+		sgxSpecialBoCacheRemove(pScreen, pPVR, entry);
+
+	xorg_list_for_each_entry_safe(slab, slab_tmp, &pPVR->slab_list, list)
+		sgxSlabDestroy(pScreen, pPVR, slab);
+
 	DEBUG_MSG("%s bo cache size after cleanup %lu",
 		  __func__, pPVR->bo_count);
+	DEBUG_MSG("%s bo cache stats: hits %lu, misses %lu, waste %llu KiB",
+		  __func__, pPVR->bo_cache_hit, pPVR->bo_cache_miss,
+		  pPVR->bo_cache_waste / 1024);
+	DEBUG_MSG("%s GPU map stats: hits %lu, misses %lu, remaps %lu",
+		  __func__, pPVR->map_hit, pPVR->map_miss, pPVR->map_remap);
+	DEBUG_MSG("%s CPU batches: fills %lu", __func__, pPVR->sw_fills);
+
+	if (pPVR->composite_check)
+		INFO_MSG("HW composite check: %lu of %lu operations differ",
+			 pPVR->check_mismatch, pPVR->check_count);
+
+	sgxUnmapFlush(pScreen, pPVR, TRUE);
 
 	if (pPVR->scanout_priv) {
 		PrivPixmapPtr pvrPixmapPriv = pPVR->scanout_priv;
@@ -449,10 +1504,13 @@ CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 		if (pvrPixmapPriv->meminfo.hPrivateData)
 			PVRUnMapBo(pScreen, pPVR->srv, &pvrPixmapPriv->meminfo);
 
-		free(pvrPixmapPriv);
+		sgxFreePrivPixmap(pPVR, pvrPixmapPriv);
 		pPVR->scanout_priv = NULL;
 	}
 
+	OMAPPoolFini(&pPVR->priv_pool);
+	OMAPPoolFini(&pPVR->entry_pool);
+
 	exaDriverFini(pScreen);
 	free(pOMAP->pOMAPEXA);
 	pOMAP->pOMAPEXA = NULL;
@@ -460,6 +1518,24 @@ CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	return TRUE;
 }
 
+static void
+BlockHandler(ScreenPtr pScreen, pointer pTimeout)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+
+	/* end of the request burst, submit whatever is still queued */
+	sgxQueueFlush(pScreen);
+
+	sgxBoCacheAge(pScreen, pPVR, pTimeout);
+
+	sgxUnmapFlush(pScreen, pPVR, FALSE);
+
+	/* retry soon for mappings the GPU is still using */
+	if (pPVR->unmap_count)
+		AdjustWaitForDelay(pTimeout, 10);
+}
+
 static void
 FreeScreen(FREE_SCREEN_ARGS_DECL)
 {
@@ -478,8 +1554,13 @@ sgxDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 
 	DEBUG_MSG("%s", __func__);
 
-	if ((pixmapPriv->flags & OMAP_BO_WC) &&
-	    (pixmapPriv->flags & ~OMAP_BO_WC) == 0) {
+	if (sgxQueueUses(PVREXAPTR(pScrn), pixmapPriv))
+		sgxQueueFlush(pScreen);
+
+	if (sgxPixmapInSlab(pixmapPriv))
+		sgxSlabFree(pScreen, pixmapPriv);
+	else if ((pixmapPriv->flags & OMAP_BO_WC) &&
+		 (pixmapPriv->flags & ~OMAP_BO_WC) == 0) {
 		if (!sgxBoCachePut(pScreen, pixmapPriv->bo, pixmapPriv->priv))
 			sgxUnmapPixmapBo(pScreen, driverPriv);
 		else {
@@ -487,12 +1568,75 @@ sgxDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 			pixmapPriv->bo = NULL;
 			pixmapPriv->priv = NULL;
 		}
+	} else if (sgxSpecialBoCachePut(pScreen, pixmapPriv)) {
+		pixmapPriv->bo = NULL;
+		pixmapPriv->priv = NULL;
 	} else
 		sgxUnmapPixmapBo(pScreen, driverPriv);
 
 	OMAPDestroyPixmap(pScreen, driverPriv);
 }
 
+static Bool
+sgxModifySpecialPixmapHeader(PixmapPtr pPixmap, int width, int height,
+			     int depth, int bitsPerPixel, int devKind)
+{
+	ScreenPtr pScreen = pPixmap->drawable.pScreen;
+	OMAPPixmapPrivPtr priv = exaGetPixmapDriverPrivate(pPixmap);
+	PrivPixmapPtr pvrPixmapPriv = priv->priv;
+	struct omap_bo *bo;
+	BoCacheKeyRec key;
+	Bool ret;
+
+	if (!miModifyPixmapHeader(pPixmap, width, height, depth, bitsPerPixel,
+				  devKind, NULL)) {
+		return FALSE;
+	}
+
+	key.usage_hint = pPixmap->usage_hint;
+	key.width = pPixmap->drawable.width;
+	key.height = pPixmap->drawable.height;
+	key.bitsPerPixel = pPixmap->drawable.bitsPerPixel;
+
+	if (!priv->bo || !pvrPixmapPriv ||
+	    !sgxBoCacheKeyEqual(&pvrPixmapPriv->key, &key)) {
+		/* BO is going to be replaced, recycle it */
+		if (sgxSpecialBoCachePut(pScreen, priv)) {
+			priv->bo = NULL;
+			priv->priv = NULL;
+		} else
+			sgxUnmapPixmapBo(pScreen, priv);
+
+		if (!priv->bo) {
+			priv->bo = sgxSpecialBoCacheGet(pScreen, &key,
+							&priv->priv,
+							&priv->tiled);
+		}
+	}
+
+	bo = priv->bo;
+
+	/* the generic code reallocates whenever the BO size differs from
+	 * devKind * height, which is the common case for Xv
+	 */
+	ret = OMAPModifyPixmapHeader(pPixmap, width, height, depth,
+				     bitsPerPixel, devKind, NULL);
+
+	/* the mapping and fd still belong to the BO just replaced */
+	if (priv->bo != bo)
+		sgxUnmapPixmapBo(pScreen, priv);
+
+	if (!ret)
+		return FALSE;
+
+	pvrPixmapPriv = sgxGetPrivPixmap(PVREXAPTR(pix2scrn(pPixmap)), priv);
+
+	if (pvrPixmapPriv)
+		pvrPixmapPriv->key = key;
+
+	return TRUE;
+}
+
 static Bool
 sgxModifyPixmapHeader(PixmapPtr pPixmap, int width, int height, int depth,
 		      int bitsPerPixel, int devKind, pointer pPixData)
@@ -504,15 +1648,23 @@ sgxModifyPixmapHeader(PixmapPtr pPixmap, int width, int height, int depth,
 	uint32_t size;
 	Bool ret;
 
-	if (pPixmap->usage_hint & (OMAP_CREATE_PIXMAP_TILED |
-				   OMAP_CREATE_PIXMAP_SCANOUT |
-				   OMAP_CREATE_PIXMAP_XV) ||
-	    pPixData) {
+	if (sgxQueueUses(PVREXAPTR(pScrn), priv))
+		sgxQueueFlush(pScreen);
+
+	if (pPixData) {
 		sgxUnmapPixmapBo(pScreen, priv);
 		return OMAPModifyPixmapHeader(pPixmap, width, height, depth,
 					      bitsPerPixel, devKind, pPixData);
 	}
 
+	if (pPixmap->usage_hint & (OMAP_CREATE_PIXMAP_TILED |
+				   OMAP_CREATE_PIXMAP_SCANOUT |
+				   OMAP_CREATE_PIXMAP_XV)) {
+		return sgxModifySpecialPixmapHeader(pPixmap, width, height,
+						    depth, bitsPerPixel,
+						    devKind);
+	}
+
 	ret = miModifyPixmapHeader(pPixmap, width, height, depth,
 			bitsPerPixel, devKind, NULL);
 	if (!ret)
@@ -525,6 +1677,21 @@ sgxModifyPixmapHeader(PixmapPtr pPixmap, int width, int height, int depth,
 	pPixmap->devKind = OMAPCalculateStride(width, bitsPerPixel);
 	size = pPixmap->devKind * height;
 
+	/* small pixmaps share slabs, unless DRI2 clients see them */
+	if (sgxPixmapInSlab(priv)) {
+		if (size <= PVR_SLAB_MAX_PIXMAP && !priv->pinned &&
+		    sgxSlabFits(priv, size)) {
+			return TRUE;
+		}
+
+		sgxSlabFree(pScreen, priv);
+	}
+
+	if (!priv->bo && size && size <= PVR_SLAB_MAX_PIXMAP && !priv->pinned &&
+	    sgxSlabAlloc(pScreen, priv, size)) {
+		return TRUE;
+	}
+
 	if ((!priv->bo) || (omap_bo_size(priv->bo) < size)) {
 		struct omap_bo *bo;
 
@@ -669,11 +1836,84 @@ pvrInitBoundingBox(SGXHW_RENDER_RECTS *pBoundingBox,
 	return IMG_TRUE;
 }
 
+/*
+ * Grow prev by rect if the two share an edge, so the union is a rect.
+ * Copies (src set) must also move by the same delta.
+ */
+static Bool
+pvrMergeRect(SGXHW_RENDER_RECTS *prev, SGXHW_RENDER_RECTS *rect,
+	     SGXHW_RENDER_RECTS *prevSrc, SGXHW_RENDER_RECTS *src)
+{
+	if (src && (src->x0 - rect->x0 != prevSrc->x0 - prev->x0 ||
+		    src->y0 - rect->y0 != prevSrc->y0 - prev->y0))
+		return FALSE;
+
+	if (rect->x0 == prev->x0 && rect->x1 == prev->x1) {
+		if (rect->y0 == prev->y1) {
+			prev->y1 = rect->y1;
+			if (src)
+				prevSrc->y1 = src->y1;
+			return TRUE;
+		} else if (rect->y1 == prev->y0) {
+			prev->y0 = rect->y0;
+			if (src)
+				prevSrc->y0 = src->y0;
+			return TRUE;
+		}
+	} else if (rect->y0 == prev->y0 && rect->y1 == prev->y1) {
+		if (rect->x0 == prev->x1) {
+			prev->x1 = rect->x1;
+			if (src)
+				prevSrc->x1 = src->x1;
+			return TRUE;
+		} else if (rect->x1 == prev->x0) {
+			prev->x0 = rect->x0;
+			if (src)
+				prevSrc->x0 = src->x0;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*
+ * Merge neighbouring rects of a batch before it is submitted. Only rects
+ * adjacent in submission order are merged and no pixel gets covered
+ * twice, so the result is the same for any ROP. Returns the new number
+ * of rects.
+ */
+static int
+pvrCoalesceRects(SGXHW_RENDER_RECTS *destRects, SGXHW_RENDER_RECTS *srcRects,
+		 int numRects)
+{
+	int i, n = 0;
+
+	if (!numRects)
+		return 0;
+
+	for (i = 1; i < numRects; i++) {
+		if (pvrMergeRect(&destRects[n], &destRects[i],
+				 srcRects ? &srcRects[n] : NULL,
+				 srcRects ? &srcRects[i] : NULL))
+			continue;
+
+		n++;
+		destRects[n] = destRects[i];
+
+		if (srcRects)
+			srcRects[n] = srcRects[i];
+	}
+
+	return n + 1;
+}
+
 static void
 sgxCompositeResetCoordinates(PVRRenderOp *pRenderOp)
 {
 	pRenderOp->numBltRects = 0;
 	pRenderOp->bltRectsIdx = 0;
+	pRenderOp->stretched = FALSE;
 
 	if (pRenderOp->pDest ){
 		pvrInitBoundingBox(&pRenderOp->bltRects.destBoundBox,
@@ -756,82 +1996,444 @@ sgxCompositeValidateBoundingBox(PVRRenderOp *pRenderOp)
 		}
 	}
 
-	return IMG_TRUE;
+	return IMG_TRUE;
+}
+
+static Bool
+sgxPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask, Pixel fill_colour)
+{
+	OMAPPixmapPrivPtr pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
+	PVRPtr pPVR = PVREXAPTR(pix2scrn(pPixmap));
+	PrivPixmapPtr pvrPixmapPriv;
+	int bitsPerPixel = pPixmap->drawable.bitsPerPixel;
+
+	if (planemask != -1)
+		return FALSE;
+
+	if (bitsPerPixel != 8 && bitsPerPixel != 16 && bitsPerPixel != 32) {
+		return FALSE;
+	}
+
+	/* same fill as the queued one, keep adding to its batch */
+	if (pPVR->queued == PVR_QUEUE_SOLID && gsSolidOp.pPixmap == pPixmap &&
+	    gsSolidOp.alu == alu && gsSolidOp.fg == fill_colour) {
+		pPVR->queued = PVR_QUEUE_NONE;
+		return TRUE;
+	}
+
+	sgxQueueFlush(pPixmap->drawable.pScreen);
+	sgxMapOpBegin(pPixmap->drawable.pScreen);
+
+	pvrPixmapPriv = sgxMapPixmapBo(pPixmap->drawable.pScreen, pixmapPriv);
+
+	if (!pvrPixmapPriv)
+		return FALSE;
+
+	memset(&gsSolidOp, 0, sizeof(gsSolidOp));
+	gsSolidOp.pPixmap = pPixmap;
+	gsSolidOp.alu = alu;
+	gsSolidOp.fg = fill_colour;
+
+	switch (alu) {
+		case GXcopy:
+			gsSolidOp.swFill = TRUE;
+			gsSolidOp.swColour = fill_colour;
+			break;
+		case GXclear:
+			gsSolidOp.swFill = TRUE;
+			gsSolidOp.swColour = 0;
+			break;
+		case GXset:
+			gsSolidOp.swFill = TRUE;
+			gsSolidOp.swColour = ~0;
+			break;
+		default:
+			break;
+	}
+
+	if (bitsPerPixel == 16 || bitsPerPixel == 32) {
+		gsSolidOp.solid2D.ColourKey = 0;
+		gsSolidOp.solid2D.CopyCode = sgxRop[1][alu];
+		gsSolidOp.idempotent = sgxRopIdempotent[alu];
+
+		gsSolidOp.solid2D.pSrcMemInfo = 0;
+		gsSolidOp.solid2D.SrcOffset = 0;
+		gsSolidOp.solid2D.SrcStride = 0;
+		gsSolidOp.solid2D.SrcX = 0;
+		gsSolidOp.solid2D.SrcY = 0;
+		gsSolidOp.solid2D.SrcFormat = PVR2D_ARGB8888;
+
+		gsSolidOp.solid2D.pDstMemInfo = &pvrPixmapPriv->meminfo;
+		gsSolidOp.solid2D.DstOffset = pixmapPriv->offset;
+		gsSolidOp.solid2D.DstStride = exaGetPixmapPitch(pPixmap);
+		gsSolidOp.solid2D.DstSurfWidth = pPixmap->drawable.width;
+		gsSolidOp.solid2D.DstSurfHeight = pPixmap->drawable.height;
+		gsSolidOp.solid2D.pMaskMemInfo = 0;
+		gsSolidOp.solid2D.BlitFlags = PVR2D_BLIT_DISABLE_ALL;
+
+		if (bitsPerPixel == 16) {
+			gsSolidOp.solid2D.Colour = CFILL_565(fill_colour);
+			gsSolidOp.solid2D.DstFormat = PVR2D_RGB565;
+		} else {
+			gsSolidOp.solid2D.DstFormat = PVR2D_ARGB8888;
+			gsSolidOp.solid2D.Colour = fill_colour;
+		}
+	} else {
+		gsSolidOp.solid3DExt.sDst.pSurfMemInfo =
+				&pvrPixmapPriv->meminfo;
+		gsSolidOp.solid3DExt.sDst.SurfOffset = pixmapPriv->offset;
+		gsSolidOp.solid3DExt.sDst.Stride = exaGetPixmapPitch(pPixmap);
+		gsSolidOp.solid3DExt.sDst.Format = PVR2D_ALPHA8;
+		gsSolidOp.solid3DExt.sDst.SurfWidth = pPixmap->drawable.width;
+		gsSolidOp.solid3DExt.sDst.SurfHeight = pPixmap->drawable.height;
+		gsSolidOp.solid3DExt.sSrc.pSurfMemInfo =
+				&pvrPixmapPriv->meminfo;
+		gsSolidOp.solid3DExt.sSrc.SurfOffset = pixmapPriv->offset;
+		gsSolidOp.solid3DExt.sSrc.Stride = exaGetPixmapPitch(pPixmap);
+		gsSolidOp.solid3DExt.sSrc.Format = PVR2D_ALPHA8;
+		gsSolidOp.solid3DExt.sSrc.SurfWidth = pPixmap->drawable.width;
+		gsSolidOp.solid3DExt.sSrc.SurfHeight = pPixmap->drawable.height;
+		gsSolidOp.solid3DExt.hUseCode = PVRSolid8BitGetUse(alu);
+		gsSolidOp.solid3DExt.uiNumTemporaryRegisters = 1;
+		gsSolidOp.solid3DExt.UseParams[0] = fill_colour;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Blit the whole destination bounding box at once, clipped to the batch
+ * rects. Rects may overlap, so that only works for idempotent ROPs.
+ */
+static Bool
+sgxBltClipped(ScrnInfoPtr pScrn, PVRPtr pPVR, PVR2DBLTINFO *blt,
+	      SGXHW_RENDER_RECTS *rects, int numRects, SGXHW_RENDER_RECTS *box)
+{
+	static PVR2DRECT clipRects[MAX_SOLID_BATCH_RECTS];
+	PVR2DERROR iErr;
+	int i;
+
+	PVR_ASSERT(numRects <= MAX_SOLID_BATCH_RECTS);
+
+	for (i = 0; i < numRects; i++) {
+		clipRects[i].left = rects[i].x0;
+		clipRects[i].top = rects[i].y0;
+		clipRects[i].right = rects[i].x1;
+		clipRects[i].bottom = rects[i].y1;
+	}
+
+	blt->DstX = box->x0;
+	blt->DstY = box->y0;
+	blt->DSizeX = box->x1 - box->x0;
+	blt->DSizeY = box->y1 - box->y0;
+
+	iErr = PVR2DBltClipped(pPVR->srv->hPVR2DContext, blt, numRects,
+			       clipRects);
+
+	if (iErr != PVR2D_OK) {
+		DEBUG_MSG("%s: PVR2DBltClipped failed with error code: %d (%s)",
+			  __func__, iErr, sgxErrorCodeToString(iErr));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static unsigned int
+pvrRectsArea(SGXHW_RENDER_RECTS *rects, int numRects)
+{
+	unsigned int area = 0;
+	int i;
+
+	for (i = 0; i < numRects; i++)
+		area += (rects[i].x1 - rects[i].x0) * (rects[i].y1 - rects[i].y0);
+
+	return area;
+}
+
+/* the batch done by pixman on the mapped BO */
+static Bool
+sgxSolidFillSW(PixmapPtr pPixmap)
+{
+	OMAPPixmapPrivPtr pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
+	char *map = omap_bo_map(pixmapPriv->bo);
+	int i;
+
+	if (!map)
+		return FALSE;
+
+	map += pixmapPriv->offset;
+
+	for (i = 0; i < gsSolidOp.numBltRects; i++) {
+		SGXHW_RENDER_RECTS *psRect = &gsSolidOp.destRect[i];
+
+		/* partial fills are fine, the GPU fills everything again */
+		if (!pixman_fill((uint32_t *)map,
+				 exaGetPixmapPitch(pPixmap) / sizeof(uint32_t),
+				 pPixmap->drawable.bitsPerPixel,
+				 psRect->x0, psRect->y0,
+				 psRect->x1 - psRect->x0,
+				 psRect->y1 - psRect->y0,
+				 gsSolidOp.swColour))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static unsigned long
+sgxElapsed(struct timeval *start, struct timeval *stop)
+{
+	return (stop->tv_sec - start->tv_sec) * 1000000 +
+	       stop->tv_usec - start->tv_usec;
+}
+
+#ifdef INSTRUMENT_SW_FILL
+static struct timeval sgxSolidStart;
+static Bool sgxSolidTimed;
+
+/*
+ * Time the batch with pixman, from an idle pixmap. It then goes to the
+ * GPU as well, which writes the same pixels again.
+ */
+static void
+sgxSolidTimeSW(ScrnInfoPtr pScrn)
+{
+	PixmapPtr pPixmap = gsSolidOp.pPixmap;
+	struct timeval stop;
+
+	waitForBlitsCompleteOnDeviceMem(pPixmap);
+	gettimeofday(&sgxSolidStart, NULL);
+	sgxSolidTimed = sgxSolidFillSW(pPixmap);
+	gettimeofday(&stop, NULL);
+
+	if (sgxSolidTimed)
+		DEBUG_MSG("fill %u pixels in %d rects, %d bpp: pixman %lu us",
+			  pvrRectsArea(gsSolidOp.destRect,
+				       gsSolidOp.numBltRects),
+			  gsSolidOp.numBltRects,
+			  pPixmap->drawable.bitsPerPixel,
+			  sgxElapsed(&sgxSolidStart, &stop));
+
+	gettimeofday(&sgxSolidStart, NULL);
+}
+
+/*
+ * The GPU time includes the submission and the wait for the result, on
+ * the blit counters: sgxWaitPixmap() skips the scanout unless it is
+ * updated manually.
+ */
+static void
+sgxSolidTimeHW(ScrnInfoPtr pScrn)
+{
+	struct timeval stop;
+
+	if (!sgxSolidTimed)
+		return;
+
+	waitForBlitsCompleteOnDeviceMem(gsSolidOp.pPixmap);
+	gettimeofday(&stop, NULL);
+	DEBUG_MSG("fill %u pixels in %d rects: SGX %lu us",
+		  pvrRectsArea(gsSolidOp.destRect, gsSolidOp.numBltRects),
+		  gsSolidOp.numBltRects, sgxElapsed(&sgxSolidStart, &stop));
+	sgxSolidTimed = FALSE;
+}
+#endif
+
+/*
+ * Tiny fills are cheaper on the CPU than a GPU submission plus the later
+ * wait for it, unless the CPU had to wait for the GPU first. Tiled
+ * pixmaps are left to the GPU, CPU access to them is slow. Build with
+ * INSTRUMENT_SW_FILL to time the batches both ways for SWFillArea.
+ */
+static Bool
+sgxSolidBatchSW(ScrnInfoPtr pScrn, PVRPtr pPVR)
+{
+	PixmapPtr pPixmap = gsSolidOp.pPixmap;
+	OMAPPixmapPrivPtr pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
+#ifndef INSTRUMENT_SW_FILL
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
+	unsigned int maxArea = pOMAP->SWFillArea;
+#endif
+
+	if (!gsSolidOp.numBltRects || !gsSolidOp.swFill || pixmapPriv->tiled)
+		return FALSE;
+
+#ifdef INSTRUMENT_SW_FILL
+	/* the GPU still does the batch, sgxSolidTimeHW() times it */
+	sgxSolidTimeSW(pScrn);
+	return FALSE;
+#else
+	if (pOMAP->SWFillArea <= 0)
+		return FALSE;
+
+	if (gsSolidOp.maxArea > maxArea ||
+	    pvrRectsArea(gsSolidOp.destRect, gsSolidOp.numBltRects) > maxArea)
+		return FALSE;
+
+	if (!sgxPixmapIdle(pPVR, pPixmap, TRUE))
+		return FALSE;
+
+	if (!sgxSolidFillSW(pPixmap))
+		return FALSE;
+
+	pPVR->sw_fills++;
+
+	return TRUE;
+#endif
 }
 
-static Bool
-sgxPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask, Pixel fill_colour)
+/*
+ * HWCompositeCheck of fill and copy batches: before a batch is coalesced,
+ * pixman does its rects one by one, as EXA handed them over, into a
+ * shadow of their bounding box.  Once the GPU is done with the coalesced
+ * batch, the pixmap has to match the shadow exactly.
+ */
+static pixman_image_t *
+sgxPixmapImage(PixmapPtr pPixmap)
 {
 	OMAPPixmapPrivPtr pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
-	PrivPixmapPtr pvrPixmapPriv;
-	int bitsPerPixel = pPixmap->drawable.bitsPerPixel;
+	pixman_format_code_t format;
+	char *map;
+
+	switch (pPixmap->drawable.bitsPerPixel) {
+	case 32:
+		format = PIXMAN_a8r8g8b8;
+		break;
+	case 16:
+		format = PIXMAN_r5g6b5;
+		break;
+	case 8:
+		format = PIXMAN_a8;
+		break;
+	default:
+		return NULL;
+	}
 
-	if (planemask != -1)
-		return FALSE;
+	map = omap_bo_map(pixmapPriv->bo);
 
-	if (bitsPerPixel != 8 && bitsPerPixel != 16 && bitsPerPixel != 32) {
-		return FALSE;
+	if (!map)
+		return NULL;
+
+	return pixman_image_create_bits(format, pPixmap->drawable.width,
+					pPixmap->drawable.height,
+					(uint32_t *)(map + pixmapPriv->offset),
+					exaGetPixmapPitch(pPixmap));
+}
+
+/* the pixmap under the bounding box of the rects, once the GPU is done */
+static pixman_image_t *
+sgxBatchShadow(PixmapPtr pPixmap, SGXHW_RENDER_RECTS *rects, int numRects,
+	       SGXHW_RENDER_RECTS *box)
+{
+	pixman_image_t *image, *shadow;
+	int i;
+
+	if (!numRects)
+		return NULL;
+
+	*box = rects[0];
+
+	for (i = 1; i < numRects; i++) {
+		if (rects[i].x0 < box->x0)
+			box->x0 = rects[i].x0;
+		if (rects[i].y0 < box->y0)
+			box->y0 = rects[i].y0;
+		if (rects[i].x1 > box->x1)
+			box->x1 = rects[i].x1;
+		if (rects[i].y1 > box->y1)
+			box->y1 = rects[i].y1;
 	}
 
-	pvrPixmapPriv = sgxMapPixmapBo(pPixmap->drawable.pScreen, pixmapPriv);
+	waitForBlitsCompleteOnDeviceMem(pPixmap);
+	image = sgxPixmapImage(pPixmap);
 
-	if (!pvrPixmapPriv)
-		return FALSE;
+	if (!image)
+		return NULL;
 
-	memset(&gsSolidOp, 0, sizeof(gsSolidOp));
-	gsSolidOp.pPixmap = pPixmap;
+	shadow = pixman_image_create_bits(pixman_image_get_format(image),
+					  box->x1 - box->x0, box->y1 - box->y0,
+					  NULL, 0);
 
-	if (bitsPerPixel == 16 || bitsPerPixel == 32) {
-		gsSolidOp.solid2D.ColourKey = 0;
-		gsSolidOp.solid2D.CopyCode = sgxRop[1][alu];
+	if (shadow)
+		pixman_image_composite32(PIXMAN_OP_SRC, image, NULL, shadow,
+					 box->x0, box->y0, 0, 0, 0, 0,
+					 box->x1 - box->x0, box->y1 - box->y0);
 
-		gsSolidOp.solid2D.pSrcMemInfo = 0;
-		gsSolidOp.solid2D.SrcOffset = 0;
-		gsSolidOp.solid2D.SrcStride = 0;
-		gsSolidOp.solid2D.SrcX = 0;
-		gsSolidOp.solid2D.SrcY = 0;
-		gsSolidOp.solid2D.SrcFormat = PVR2D_ARGB8888;
+	pixman_image_unref(image);
 
-		gsSolidOp.solid2D.pDstMemInfo = &pvrPixmapPriv->meminfo;
-		gsSolidOp.solid2D.DstStride = exaGetPixmapPitch(pPixmap);
-		gsSolidOp.solid2D.DstSurfWidth = pPixmap->drawable.width;
-		gsSolidOp.solid2D.DstSurfHeight = pPixmap->drawable.height;
-		gsSolidOp.solid2D.pMaskMemInfo = 0;
-		gsSolidOp.solid2D.BlitFlags = PVR2D_BLIT_DISABLE_ALL;
+	return shadow;
+}
 
-		if (bitsPerPixel == 16) {
-			gsSolidOp.solid2D.Colour = CFILL_565(fill_colour);
-			gsSolidOp.solid2D.DstFormat = PVR2D_RGB565;
-		} else {
-			gsSolidOp.solid2D.DstFormat = PVR2D_ARGB8888;
-			gsSolidOp.solid2D.Colour = fill_colour;
+static void
+sgxBatchCheck(ScrnInfoPtr pScrn, PVRPtr pPVR, PixmapPtr pPixmap,
+	      pixman_image_t *shadow, SGXHW_RENDER_RECTS *box,
+	      const char *what)
+{
+	int width = box->x1 - box->x0;
+	int height = box->y1 - box->y0;
+	pixman_image_t *image;
+	unsigned int mismatches;
+
+	waitForBlitsCompleteOnDeviceMem(pPixmap);
+	image = sgxPixmapImage(pPixmap);
+
+	if (image) {
+		mismatches = sgxCompareImages(image, box->x0, box->y0, shadow,
+					      pixman_image_get_format(shadow),
+					      width, height, 0);
+
+		pPVR->check_count++;
+
+		if (mismatches) {
+			pPVR->check_mismatch++;
+			WARNING_MSG("%s batch %dx%d at %d,%d: %u pixels differ",
+				    what, width, height, box->x0, box->y0,
+				    mismatches);
 		}
-	} else {
-		gsSolidOp.solid3DExt.sDst.pSurfMemInfo =
-				&pvrPixmapPriv->meminfo;
-		gsSolidOp.solid3DExt.sDst.SurfOffset = 0;
-		gsSolidOp.solid3DExt.sDst.Stride = exaGetPixmapPitch(pPixmap);
-		gsSolidOp.solid3DExt.sDst.Format = PVR2D_ALPHA8;
-		gsSolidOp.solid3DExt.sDst.SurfWidth = pPixmap->drawable.width;
-		gsSolidOp.solid3DExt.sDst.SurfHeight = pPixmap->drawable.height;
-		gsSolidOp.solid3DExt.sSrc.pSurfMemInfo =
-				&pvrPixmapPriv->meminfo;
-		gsSolidOp.solid3DExt.sSrc.SurfOffset = 0;
-		gsSolidOp.solid3DExt.sSrc.Stride = exaGetPixmapPitch(pPixmap);
-		gsSolidOp.solid3DExt.sSrc.Format = PVR2D_ALPHA8;
-		gsSolidOp.solid3DExt.sSrc.SurfWidth = pPixmap->drawable.width;
-		gsSolidOp.solid3DExt.sSrc.SurfHeight = pPixmap->drawable.height;
-		gsSolidOp.solid3DExt.hUseCode = PVRSolid8BitGetUse(alu);
-		gsSolidOp.solid3DExt.uiNumTemporaryRegisters = 1;
-		gsSolidOp.solid3DExt.UseParams[0] = fill_colour;
+
+		pixman_image_unref(image);
 	}
 
-	return TRUE;
+	pixman_image_unref(shadow);
+}
+
+/* plain fills, the ones pixman can do */
+static pixman_image_t *
+sgxSolidCheckShadow(SGXHW_RENDER_RECTS *box)
+{
+	PixmapPtr pPixmap = gsSolidOp.pPixmap;
+	pixman_image_t *shadow;
+	int i;
+
+	if (!gsSolidOp.swFill)
+		return NULL;
+
+	shadow = sgxBatchShadow(pPixmap, gsSolidOp.destRect,
+				gsSolidOp.numBltRects, box);
+
+	if (!shadow)
+		return NULL;
+
+	for (i = 0; i < gsSolidOp.numBltRects; i++) {
+		SGXHW_RENDER_RECTS *psRect = &gsSolidOp.destRect[i];
+
+		pixman_fill(pixman_image_get_data(shadow),
+			    pixman_image_get_stride(shadow) / sizeof(uint32_t),
+			    pPixmap->drawable.bitsPerPixel,
+			    psRect->x0 - box->x0, psRect->y0 - box->y0,
+			    psRect->x1 - psRect->x0, psRect->y1 - psRect->y0,
+			    gsSolidOp.swColour);
+	}
+
+	return shadow;
 }
 
 static void
 sgxSolidNextBatch(ScrnInfoPtr pScrn, PVRPtr pPVR, Bool flush)
 {
+	pixman_image_t *shadow = NULL;
+	SGXHW_RENDER_RECTS box;
 	int i;
 
 	if (!flush) {
@@ -853,7 +2455,25 @@ sgxSolidNextBatch(ScrnInfoPtr pScrn, PVRPtr pPVR, Bool flush)
 		gsSolidOp.destBoundBox.y1 = gsSolidOp.destSurfaceBox.y1;
 	}
 
-	for (i = 0; i < gsSolidOp.numBltRects; i++) {
+	if (pPVR->composite_check)
+		shadow = sgxSolidCheckShadow(&box);
+
+	gsSolidOp.numBltRects = pvrCoalesceRects(gsSolidOp.destRect, NULL,
+						 gsSolidOp.numBltRects);
+
+	if (sgxSolidBatchSW(pScrn, pPVR)) {
+		i = gsSolidOp.numBltRects;
+	} else if (gsSolidOp.numBltRects > 1 && gsSolidOp.idempotent &&
+		   gsSolidOp.pPixmap->drawable.bitsPerPixel != 8 &&
+		   sgxBltClipped(pScrn, pPVR, &gsSolidOp.solid2D,
+				 gsSolidOp.destRect, gsSolidOp.numBltRects,
+				 &gsSolidOp.destBoundBox)) {
+		i = gsSolidOp.numBltRects;
+	} else {
+		i = 0;
+	}
+
+	for (; i < gsSolidOp.numBltRects; i++) {
 		SGXHW_RENDER_RECTS *psRect = &gsSolidOp.destRect[i];
 		PVR2DERROR iErr;
 
@@ -899,6 +2519,14 @@ sgxSolidNextBatch(ScrnInfoPtr pScrn, PVRPtr pPVR, Bool flush)
 		}
 	}
 
+#ifdef INSTRUMENT_SW_FILL
+	sgxSolidTimeHW(pScrn);
+#endif
+
+	if (shadow)
+		sgxBatchCheck(pScrn, pPVR, gsSolidOp.pPixmap, shadow, &box,
+			      "fill");
+
 	gsSolidOp.numBltRects = 0;
 	gsSolidOp.bltRectsIdx = 0;
 
@@ -960,13 +2588,9 @@ sgxDoneSolid(PixmapPtr pPixmap)
 
 	PVR_ASSERT(gsSolidOp.pPixmap == pPixmap);
 
-	sgxSolidNextBatch(pScrn, pPVR, TRUE);
-
-	setPixmapOnGPU(pPixmap);
-	flushScanout(pPixmap);
+	sgxQueueScanout(pPVR, pPixmap);
 
-	gsSolidOp.softFallback.psGC = NULL;
-	gsSolidOp.pPixmap = NULL;
+	pPVR->queued = PVR_QUEUE_SOLID;
 }
 
 static PVR2DFORMAT
@@ -994,6 +2618,7 @@ sgxPrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir, int alu,
 	       Pixel planemask)
 {
 	int bitsPerPixel = pSrc->drawable.bitsPerPixel;
+	PVRPtr pPVR = PVREXAPTR(pix2scrn(pDst));
 	OMAPPixmapPrivPtr dstPriv;
 	OMAPPixmapPrivPtr srcPriv;
 	PrivPixmapPtr pvrDstPriv;
@@ -1006,7 +2631,23 @@ sgxPrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir, int alu,
 		return FALSE;
 	}
 
+	/*
+	 * Same copy as the queued one, keep adding to its batch. Copies
+	 * within a pixmap may read what the queued rects write, so those
+	 * are submitted first.
+	 */
+	if (pPVR->queued == PVR_QUEUE_COPY && pSrc != pDst &&
+	    gsCopy2DOp.renderOp.pSrc == pSrc &&
+	    gsCopy2DOp.renderOp.pDest == pDst && gsCopy2DOp.alu == alu) {
+		pPVR->queued = PVR_QUEUE_NONE;
+		return TRUE;
+	}
+
+	sgxQueueFlush(pDst->drawable.pScreen);
+	sgxMapOpBegin(pDst->drawable.pScreen);
+
 	memset(&gsCopy2DOp, 0, sizeof(gsCopy2DOp));
+	gsCopy2DOp.alu = alu;
 
 	dstPriv = exaGetPixmapDriverPrivate(pDst);
 	pvrDstPriv = sgxMapPixmapBo(pDst->drawable.pScreen, dstPriv);
@@ -1020,11 +2661,13 @@ sgxPrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir, int alu,
 	if (copy2d(bitsPerPixel)) {
 		gsCopy2DOp.blt2D.ColourKey = 0;
 		gsCopy2DOp.blt2D.CopyCode = sgxRop[0][alu];
+		gsCopy2DOp.idempotent = sgxRopIdempotent[alu];
 
 		gsCopy2DOp.blt2D.SrcFormat =
 				convertBitsPerPixelToPVR2DFormat(
 					pSrc->drawable.bitsPerPixel);
 		gsCopy2DOp.blt2D.pSrcMemInfo = &pvrSrcPriv->meminfo;
+		gsCopy2DOp.blt2D.SrcOffset = srcPriv->offset;
 		gsCopy2DOp.blt2D.SrcStride = exaGetPixmapPitch(pSrc);
 		gsCopy2DOp.blt2D.SrcSurfWidth = pSrc->drawable.width;
 		gsCopy2DOp.blt2D.SrcSurfHeight = pSrc->drawable.height;
@@ -1033,6 +2676,7 @@ sgxPrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir, int alu,
 				convertBitsPerPixelToPVR2DFormat(
 					pDst->drawable.bitsPerPixel);
 		gsCopy2DOp.blt2D.pDstMemInfo = &pvrDstPriv->meminfo;
+		gsCopy2DOp.blt2D.DstOffset = dstPriv->offset;
 		gsCopy2DOp.blt2D.DstStride = exaGetPixmapPitch(pDst);
 		gsCopy2DOp.blt2D.DstSurfWidth = pDst->drawable.width;
 		gsCopy2DOp.blt2D.DstSurfHeight = pDst->drawable.height;
@@ -1044,11 +2688,13 @@ sgxPrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir, int alu,
 				convertBitsPerPixelToPVR2DFormat(
 					pSrc->drawable.bitsPerPixel);
 		gsCopy2DOp.blt3D.sSrc.pSurfMemInfo = &pvrSrcPriv->meminfo;
+		gsCopy2DOp.blt3D.sSrc.SurfOffset = srcPriv->offset;
 		gsCopy2DOp.blt3D.sSrc.SurfWidth = pSrc->drawable.width;
 		gsCopy2DOp.blt3D.sSrc.SurfHeight = pSrc->drawable.height;
 		gsCopy2DOp.blt3D.sSrc.Stride = exaGetPixmapPitch(pSrc);
 
 		gsCopy2DOp.blt3D.sDst.pSurfMemInfo = &pvrDstPriv->meminfo;
+		gsCopy2DOp.blt3D.sDst.SurfOffset = dstPriv->offset;
 		gsCopy2DOp.blt3D.sDst.SurfWidth = pDst->drawable.width;
 		gsCopy2DOp.blt3D.sDst.SurfHeight = pDst->drawable.height;
 		gsCopy2DOp.blt3D.sDst.Stride = exaGetPixmapPitch(pDst);
@@ -1070,11 +2716,99 @@ sgxPrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir, int alu,
 	return TRUE;
 }
 
+/*
+ * Copies of a region (scrolling, window moves) share one src to dst delta,
+ * so the batch is a single copy of the bounding box clipped to the rects.
+ */
+static Bool
+sgxCopyBatchClipped(ScrnInfoPtr pScrn, PVRPtr pPVR)
+{
+	PVRRenderOp *pRenderOp = &gsCopy2DOp.renderOp;
+	SGXHW_RENDER_RECTS *box = &pRenderOp->bltRects.destBoundBox;
+	PixmapPtr pSrc = pRenderOp->pSrc;
+	int srcX = box->x0 + gsCopy2DOp.dx;
+	int srcY = box->y0 + gsCopy2DOp.dy;
+	int w = box->x1 - box->x0;
+	int h = box->y1 - box->y0;
+
+	if (!gsCopy2DOp.sameDelta || !gsCopy2DOp.idempotent)
+		return FALSE;
+
+	if (srcX < 0 || srcY < 0 || srcX + w > pSrc->drawable.width ||
+	    srcY + h > pSrc->drawable.height)
+		return FALSE;
+
+	gsCopy2DOp.blt2D.SrcX = srcX;
+	gsCopy2DOp.blt2D.SrcY = srcY;
+	gsCopy2DOp.blt2D.SizeX = w;
+	gsCopy2DOp.blt2D.SizeY = h;
+
+	return sgxBltClipped(pScrn, pPVR, &gsCopy2DOp.blt2D,
+			     pRenderOp->bltRects.destRect,
+			     pRenderOp->numBltRects, box);
+}
+
+/* plain copies between two pixmaps, the ones pixman can do */
+static pixman_image_t *
+sgxCopyCheckShadow(SGXHW_RENDER_RECTS *box)
+{
+	PVRRenderOp *pRenderOp = &gsCopy2DOp.renderOp;
+	PixmapPtr pSrc = pRenderOp->pSrc;
+	PixmapPtr pDst = pRenderOp->pDest;
+	int bitsPerPixel = pDst->drawable.bitsPerPixel;
+	pixman_image_t *src, *shadow;
+	int i;
+
+	if (gsCopy2DOp.alu != GXcopy || pSrc == pDst ||
+	    pSrc->drawable.bitsPerPixel != bitsPerPixel)
+		return NULL;
+
+	shadow = sgxBatchShadow(pDst, pRenderOp->bltRects.destRect,
+				pRenderOp->numBltRects, box);
+
+	if (!shadow)
+		return NULL;
+
+	waitForBlitsCompleteOnDeviceMem(pSrc);
+	src = sgxPixmapImage(pSrc);
+
+	for (i = 0; src && i < pRenderOp->numBltRects; i++) {
+		SGXHW_RENDER_RECTS *psSrcRect = &pRenderOp->bltRects.srcRect[i];
+		SGXHW_RENDER_RECTS *psDstRect =
+				&pRenderOp->bltRects.destRect[i];
+
+		if (!pixman_blt(pixman_image_get_data(src),
+				pixman_image_get_data(shadow),
+				pixman_image_get_stride(src) / sizeof(uint32_t),
+				pixman_image_get_stride(shadow) /
+				sizeof(uint32_t),
+				bitsPerPixel, bitsPerPixel,
+				psSrcRect->x0, psSrcRect->y0,
+				psDstRect->x0 - box->x0,
+				psDstRect->y0 - box->y0,
+				psDstRect->x1 - psDstRect->x0,
+				psDstRect->y1 - psDstRect->y0))
+			break;
+	}
+
+	if (!src || i < pRenderOp->numBltRects) {
+		pixman_image_unref(shadow);
+		shadow = NULL;
+	}
+
+	if (src)
+		pixman_image_unref(src);
+
+	return shadow;
+}
+
 static void
 sgxCopyNextBatch(ScreenPtr pScreen, Bool flush)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	PVRPtr pPVR = PVREXAPTR(pScrn);
+	pixman_image_t *shadow = NULL;
+	SGXHW_RENDER_RECTS box;
 	int i;
 	int bitsPerPixel;
 
@@ -1091,9 +2825,23 @@ sgxCopyNextBatch(ScreenPtr pScreen, Bool flush)
 		return;
 	}
 
+	if (pPVR->composite_check)
+		shadow = sgxCopyCheckShadow(&box);
+
+	gsCopy2DOp.renderOp.numBltRects =
+			pvrCoalesceRects(gsCopy2DOp.renderOp.bltRects.destRect,
+					 gsCopy2DOp.renderOp.bltRects.srcRect,
+					 gsCopy2DOp.renderOp.numBltRects);
+
 	bitsPerPixel= gsCopy2DOp.renderOp.pSrc->drawable.bitsPerPixel;
 
-	for (i = 0; i < gsCopy2DOp.renderOp.numBltRects; i++)
+	if (gsCopy2DOp.renderOp.numBltRects > 1 && copy2d(bitsPerPixel) &&
+	    sgxCopyBatchClipped(pScrn, pPVR)) {
+		i = gsCopy2DOp.renderOp.numBltRects;
+	} else
+		i = 0;
+
+	for (; i < gsCopy2DOp.renderOp.numBltRects; i++)
 	{
 		SGXHW_RENDER_RECTS *psSrcRect =
 				&gsCopy2DOp.renderOp.bltRects.srcRect[i];
@@ -1151,6 +2899,10 @@ sgxCopyNextBatch(ScreenPtr pScreen, Bool flush)
 		}
 	}
 
+	if (shadow)
+		sgxBatchCheck(pScrn, pPVR, gsCopy2DOp.renderOp.pDest, shadow,
+			      &box, "copy");
+
 	sgxCompositeResetCoordinates(&gsCopy2DOp.renderOp);
 }
 
@@ -1214,6 +2966,15 @@ sgxCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX, int dstY,
 	srcRect->x1 = srcX + w;
 	srcRect->y1 = srcY + h;
 
+	if (!bltRectsIdx) {
+		gsCopy2DOp.dx = srcX - dstX;
+		gsCopy2DOp.dy = srcY - dstY;
+		gsCopy2DOp.sameDelta = TRUE;
+	} else if (gsCopy2DOp.dx != srcX - dstX ||
+		   gsCopy2DOp.dy != srcY - dstY) {
+		gsCopy2DOp.sameDelta = FALSE;
+	}
+
 	pvrAddRectToBoundingBox(&rects->srcBoundBox,
 				&rects->srcRect[bltRectsIdx],
 				&rects->srcSurfaceBox);
@@ -1225,15 +2986,49 @@ sgxCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX, int dstY,
 static void
 sgxDoneCopy(PixmapPtr pPixmap)
 {
+	PVRPtr pPVR = PVREXAPTR(pix2scrn(pPixmap));
+
 	PVR_ASSERT(gsCopy2DOp.renderOp.pDest == pPixmap);
 
-	sgxCopyNextBatch(pPixmap->drawable.pScreen, TRUE);
+	sgxQueueScanout(pPVR, pPixmap);
+
+	pPVR->queued = PVR_QUEUE_COPY;
+}
+
+/*
+ * Solid and copy batches stay open after Done*, so that following
+ * operations with the same parameters go to the GPU in one submission.
+ * They are submitted before the CPU or a different GPU operation touches
+ * pixmaps, and at the latest from the BlockHandler.
+ */
+void
+sgxQueueFlush(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+	PVRQueueOp queued = pPVR->queued;
+	PixmapPtr pPixmap = pPVR->scanout_dirty;
 
-	setPixmapOnGPU(pPixmap);
-	flushScanout(pPixmap);
+	pPVR->queued = PVR_QUEUE_NONE;
+	pPVR->scanout_dirty = NULL;
 
-	gsCopy2DOp.renderOp.pSrc = NULL;
-	gsCopy2DOp.renderOp.pDest = NULL;
+	switch (queued) {
+		case PVR_QUEUE_SOLID:
+			sgxSolidNextBatch(pScrn, pPVR, TRUE);
+			gsSolidOp.softFallback.psGC = NULL;
+			gsSolidOp.pPixmap = NULL;
+			break;
+		case PVR_QUEUE_COPY:
+			sgxCopyNextBatch(pScreen, TRUE);
+			gsCopy2DOp.renderOp.pSrc = NULL;
+			gsCopy2DOp.renderOp.pDest = NULL;
+			break;
+		default:
+			break;
+	}
+
+	if (pPixmap)
+		flushScanout(pPixmap);
 }
 
 static RENDER_TRANSFORMATION
@@ -1247,29 +3042,59 @@ PVRGetTransformation(PictTransformPtr psTransform)
 	if (!psTransform)
 		return TRANSF_NONE;
 
+	/* projective transforms don't map rects to rects */
+	if (psTransform->matrix[2][0] || psTransform->matrix[2][1] ||
+	    psTransform->matrix[2][2] != xFixed1)
+		return TRANSF_UNKNOWN;
+
 	m00 = (double)psTransform->matrix[0][0] / 65536.0;
 	m01 = (double)psTransform->matrix[0][1] / 65536.0;
 	m10 = (double)psTransform->matrix[1][0] / 65536.0;
 	m11 = (double)psTransform->matrix[1][1] / 65536.0;
 
+	/*
+	 * Translations are taken care of by PVRApplyTransformation().  Scales
+	 * stretch the source rect, flips would need mirrored rects.
+	 */
 	if (m00 > 0.0 && m11 > 0.0 && m01 == 0.0 && m10 == 0.0)
-		return TRANSF_NONE;
+		return m00 == 1.0 && m11 == 1.0 ? TRANSF_NONE : TRANSF_SCALE;
 
 	if (m01 > 0.0 && m10 < 0.0 && m00 == 0.0 && m11 == 0.0)
 		return TRANSF_ROT_90;
 
-	if (m00 >= 0.0 || m11 >= 0.0 || m01 != 0.0 || m10 != 0.0) {
-		if (m01 >= 0.0 || m10 <= 0.0 || m00 != 0.0 || m11 != 0.0) {
-			if (pixman_transform_is_scale(psTransform))
-				return TRANSF_SCALE;
-			else
-				return TRANSF_UNKNOWN;
-		}
-		else
-			return TRANSF_ROT_270;
+	if (m00 < 0.0 && m11 < 0.0 && m01 == 0.0 && m10 == 0.0)
+		return TRANSF_ROT_180;
+
+	if (m01 < 0.0 && m10 > 0.0 && m00 == 0.0 && m11 == 0.0)
+		return TRANSF_ROT_270;
+
+	return TRANSF_UNKNOWN;
+}
+
+/* the TQ samples point or linear, no convolutions */
+static Bool
+sgxPictureFilterSupported(PicturePtr pPicture)
+{
+	switch (pPicture->filter) {
+	case PictFilterNearest:
+	case PictFilterBilinear:
+	case PictFilterFast:
+	case PictFilterGood:
+	case PictFilterBest:
+		return TRUE;
+	default:
+		return FALSE;
 	}
+}
 
-	return TRANSF_ROT_180;
+/* does the picture repeat a tile bigger than one texel? */
+static Bool
+sgxPictureTiled(PicturePtr pPicture)
+{
+	return pPicture && pPicture->repeatType != RepeatNone &&
+	       pPicture->pDrawable &&
+	       (pPicture->pDrawable->width > 1 ||
+		pPicture->pDrawable->height > 1);
 }
 
 static PVR2D_HANDLE
@@ -1298,47 +3123,39 @@ PVRRenderIsAccelerated(ScreenPtr pScreen, PVRRenderOp *pRender)
 
 	if (destFormat != PICT_a8r8g8b8 && destFormat != PICT_a8b8g8r8 &&
 	    destFormat != PICT_x8r8g8b8 && destFormat != PICT_x8b8g8r8 &&
-	    destFormat != PICT_a8) {
+	    destFormat != PICT_r5g6b5 && destFormat != PICT_a8) {
 		return NULL;
 	}
 
-	if (pSrcPicture->repeatType &&
-	    pSrc->drawable.width != 1 &&
-	    pSrc->drawable.height != 1) {
+	/* repeating tiles are split by sgxCompositeTiled(), not transformed */
+	if (sgxPictureTiled(pSrcPicture) && pSrcPicture->transform)
 		return NULL;
-	}
 
-	if (pMask) {
-		if (pMaskPicture->repeatType &&
-		    pMask->drawable.width != 1 &&
-		    pMask->drawable.height != 1) {
-			return NULL;
-		}
-	}
+	if (pMask && sgxPictureTiled(pMaskPicture) && pMaskPicture->transform)
+		return NULL;
 
 	if (pSrcPicture) {
 		srcFormat = pSrcPicture->format;
 
 		if (srcFormat != PICT_a8r8g8b8 && srcFormat != PICT_a8b8g8r8 &&
 		    srcFormat != PICT_x8r8g8b8 && srcFormat != PICT_x8b8g8r8 &&
-		    srcFormat != PICT_a8) {
+		    srcFormat != PICT_r5g6b5 && srcFormat != PICT_a8) {
 			return NULL;
 		}
 
+		if (!sgxPictureFilterSupported(pSrcPicture))
+			return NULL;
+
 		if (pSrcPicture->transform) {
 			pRender->transform = PVRGetTransformation(
 						     pSrcPicture->transform);
 
 			switch (pRender->transform) {
 				case TRANSF_UNKNOWN:
-					return NULL;
+				/* PVRRotateCopyRender() is a stub */
 				case TRANSF_ROT_90:
 				case TRANSF_ROT_180:
 				case TRANSF_ROT_270:
-					if (!pMaskPicture &&
-					    pRender->op == PictOpSrc)
-						return PVRGetUseCodeForRender(pRender);
-
 					return NULL;
 				default:
 					break;
@@ -1349,40 +3166,282 @@ PVRRenderIsAccelerated(ScreenPtr pScreen, PVRRenderOp *pRender)
 	if (!pMaskPicture)
 		return PVRGetUseCodeForRender(pRender);
 
-	if (pMaskPicture->transform &&
-	    PVRGetTransformation(pMaskPicture->transform)) {
+	if (!sgxPictureFilterSupported(pMaskPicture))
 		return NULL;
+
+	switch (PVRGetTransformation(pMaskPicture->transform)) {
+		case TRANSF_NONE:
+		case TRANSF_SCALE:
+			break;
+		default:
+			return NULL;
 	}
 
 	maskFormat = pMaskPicture->format;
 
-	if (maskFormat != PICT_a8r8g8b8 && maskFormat != PICT_a8b8g8r8 &&
-	    maskFormat != PICT_x8r8g8b8 && maskFormat != PICT_x8b8g8r8 &&
-	    maskFormat != PICT_a8) {
-		return NULL;
+	if (maskFormat != PICT_a8r8g8b8 && maskFormat != PICT_a8b8g8r8 &&
+	    maskFormat != PICT_x8r8g8b8 && maskFormat != PICT_x8b8g8r8 &&
+	    maskFormat != PICT_a8) {
+		return NULL;
+	}
+
+	return PVRGetUseCodeForRender(pRender);
+}
+
+static inline CARD32
+pvrSwapRB(CARD32 pixel)
+{
+	return (pixel & 0xff00ff00) | ((pixel >> 16) & 0xff) |
+	       ((pixel & 0xff) << 16);
+}
+
+/* every channel of a premultiplied colour times alpha, rounded like pixman */
+static inline CARD32
+pvrColourIn(CARD32 colour, unsigned int alpha)
+{
+	CARD32 result = 0;
+	int shift;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		unsigned int t = ((colour >> shift) & 0xff) * alpha + 0x80;
+
+		result |= (((t >> 8) + t) >> 8) << shift;
+	}
+
+	return result;
+}
+
+/*
+ * Colour of a solid fill picture or of an idle 1x1 repeating pixmap, as
+ * premultiplied a8r8g8b8.
+ */
+static Bool
+sgxPictureSolid(PVRPtr pPVR, PicturePtr pPicture, CARD32 *argb)
+{
+	OMAPPixmapPrivPtr pixmapPriv;
+	PixmapPtr pPixmap;
+	char *map;
+	CARD32 pixel;
+
+	if (!pPicture->pDrawable) {
+		if (!pPicture->pSourcePict ||
+		    pPicture->pSourcePict->type != SourcePictTypeSolidFill)
+			return FALSE;
+
+		*argb = pPicture->pSourcePict->solidFill.color;
+		return TRUE;
+	}
+
+	if (pPicture->pDrawable->type != DRAWABLE_PIXMAP ||
+	    pPicture->repeatType == RepeatNone || pPicture->transform ||
+	    pPicture->alphaMap || pPicture->pDrawable->width != 1 ||
+	    pPicture->pDrawable->height != 1)
+		return FALSE;
+
+	pPixmap = (PixmapPtr)pPicture->pDrawable;
+	pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
+
+	/* reading it must not wait for the GPU */
+	if (!pixmapPriv || !pixmapPriv->bo ||
+	    !sgxPixmapIdle(pPVR, pPixmap, FALSE))
+		return FALSE;
+
+	map = omap_bo_map(pixmapPriv->bo);
+
+	if (!map)
+		return FALSE;
+
+	map += pixmapPriv->offset;
+
+	switch (pPicture->format) {
+	case PICT_a8r8g8b8:
+		pixel = *(CARD32 *)map;
+		break;
+	case PICT_x8r8g8b8:
+		pixel = *(CARD32 *)map | 0xff000000;
+		break;
+	case PICT_a8b8g8r8:
+		pixel = pvrSwapRB(*(CARD32 *)map);
+		break;
+	case PICT_x8b8g8r8:
+		pixel = pvrSwapRB(*(CARD32 *)map) | 0xff000000;
+		break;
+	case PICT_a8:
+		pixel = (CARD32)*(CARD8 *)map << 24;
+		break;
+	default:
+		return FALSE;
+	}
+
+	*argb = pixel;
+
+	return TRUE;
+}
+
+/* a8r8g8b8 colour as a pixel of the destination format */
+static Bool
+pvrArgbToPixel(PictFormatShort format, CARD32 argb, Pixel *pixel)
+{
+	switch (format) {
+	case PICT_a8r8g8b8:
+	case PICT_x8r8g8b8:
+		*pixel = argb;
+		return TRUE;
+	case PICT_a8b8g8r8:
+	case PICT_x8b8g8r8:
+		*pixel = pvrSwapRB(argb);
+		return TRUE;
+	case PICT_r5g6b5:
+		*pixel = ((argb >> 8) & 0xf800) | ((argb >> 5) & 0x07e0) |
+			 ((argb >> 3) & 0x001f);
+		return TRUE;
+	case PICT_a8:
+		*pixel = argb >> 24;
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/*
+ * Constant fold a composite with a solid source and a solid (or no)
+ * mask.  The ops that come down to writing a constant become a fill, the
+ * ones that leave the destination alone are dropped.  Fills of 32 and
+ * 16 bpp pixmaps go to the 2D core, a8 ones to the solid USE fragment that
+ * takes the colour from UseParams.  An opaque solid mask is dropped, so
+ * the shader does one texture fetch less.
+ */
+static PVRCompositeFold
+sgxCompositeFold(PVRPtr pPVR, int op, PicturePtr pSrcPicture,
+		 PicturePtr pMaskPicture, PicturePtr pDstPicture,
+		 Pixel *pixel, Bool *dropMask)
+{
+	CARD32 src, mask = 0xffffffff, colour;
+	Bool ca = pMaskPicture && pMaskPicture->componentAlpha;
+
+	*dropMask = FALSE;
+
+	if (pDstPicture->alphaMap || pDstPicture->transform)
+		return PVR_FOLD_NONE;
+
+	if (op == PictOpDst)
+		return PVR_FOLD_NOOP;
+
+	if (op == PictOpClear)
+		return pvrArgbToPixel(pDstPicture->format, 0, pixel) ?
+		       PVR_FOLD_FILL : PVR_FOLD_NONE;
+
+	if (pMaskPicture && !sgxPictureSolid(pPVR, pMaskPicture, &mask))
+		return PVR_FOLD_NONE;
+
+	/* per channel masks only fold if they are all ones or all zeros */
+	if (ca && mask != 0xffffffff && mask != 0)
+		return PVR_FOLD_NONE;
+
+	if (!sgxPictureSolid(pPVR, pSrcPicture, &src)) {
+		*dropMask = pMaskPicture && (mask >> 24) == 0xff &&
+			    (!ca || mask == 0xffffffff);
+		return PVR_FOLD_NONE;
+	}
+
+	colour = pvrColourIn(src, mask >> 24);
+
+	switch (op) {
+	case PictOpSrc:
+		break;
+	case PictOpOver:
+		if (colour == 0)
+			return PVR_FOLD_NOOP;
+		if ((colour >> 24) != 0xff)
+			return PVR_FOLD_NONE;
+		break;
+	case PictOpOverReverse:
+	case PictOpOutReverse:
+	case PictOpAtop:
+	case PictOpXor:
+	case PictOpAdd:
+		return colour == 0 ? PVR_FOLD_NOOP : PVR_FOLD_NONE;
+	default:
+		return PVR_FOLD_NONE;
 	}
 
-	return PVRGetUseCodeForRender(pRender);
+	return pvrArgbToPixel(pDstPicture->format, colour, pixel) ?
+	       PVR_FOLD_FILL : PVR_FOLD_NONE;
 }
 
 static Bool
 sgxCheckComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 		  PicturePtr pDstPicture)
 {
-#ifndef USE_HW_COMPOSITING
-	if (1) {
-#else
-	if (0) {
-#endif
-		sgxWaitPixmap(gsRenderOp.pSrc);
-		sgxWaitPixmap(gsRenderOp.pDest);
-		sgxWaitPixmap(gsRenderOp.pMask);
+	PVRPtr pPVR = PVREXAPTR(xf86ScreenToScrn(
+					pDstPicture->pDrawable->pScreen));
+	PVRCompositeFold fold;
+	Pixel pixel = 0;
+	Bool dropMask;
+	int gate = op;
+
+	/* folded composites are fills, done whether HWComposite is on or not */
+	fold = sgxCompositeFold(pPVR, op, pSrcPicture, pMaskPicture,
+				pDstPicture, &pixel, &dropMask);
+
+	if (fold != PVR_FOLD_NONE) {
+		gsRenderOp.fold = fold;
+		gsRenderOp.foldPixel = pixel;
+
+		/* for HWCompositeCheck, which renders it with pixman too */
+		gsRenderOp.op = op;
+		gsRenderOp.pDestPicture = pDstPicture;
+		gsRenderOp.pSrcPicture = pSrcPicture;
+		gsRenderOp.pMaskPicture = pMaskPicture;
+		gsRenderOp.pSrc = draw2pix(pSrcPicture->pDrawable);
+		gsRenderOp.pMask = pMaskPicture ?
+				   draw2pix(pMaskPicture->pDrawable) : NULL;
+		return TRUE;
+	}
 
-		return FALSE;
+	/*
+	 * The fragments blend with the alpha of the masked source, a single
+	 * value per pixel, which is wrong for Over with a per channel mask.
+	 * Turning it down makes EXA do it in two passes, OutReverse and then
+	 * Add, and those only need the per channel multiply of the MaskAlpha
+	 * fragments.  Both passes are taken when Over is enabled.
+	 */
+	if (pMaskPicture && pMaskPicture->componentAlpha) {
+		if (op == PictOpOver)
+			return FALSE;
+
+		if ((op == PictOpOutReverse || op == PictOpAdd) &&
+		    sgxCompositeEnabled(pPVR, PictOpOver, pDstPicture->format))
+			gate = PictOpOver;
 	}
 
+	/* the fallback waits for the GPU in PrepareAccess */
+	if (!sgxCompositeEnabled(pPVR, gate, pDstPicture->format))
+		return FALSE;
+
+	if (dropMask)
+		pMaskPicture = NULL;
+
 	memset(&gsRenderOp, 0, sizeof(gsRenderOp));
 
+	/* solid fills are drawn from a cached 1x1 repeating picture */
+	if (pSrcPicture && !pSrcPicture->pDrawable) {
+		pSrcPicture = sgxSolidPictureGet(pDstPicture->pDrawable->pScreen,
+						 pSrcPicture);
+
+		if (!pSrcPicture)
+			return FALSE;
+	}
+
+	if (pMaskPicture && !pMaskPicture->pDrawable) {
+		pMaskPicture = sgxSolidPictureGet(
+				       pDstPicture->pDrawable->pScreen,
+				       pMaskPicture);
+
+		if (!pMaskPicture)
+			return FALSE;
+	}
+
 	gsRenderOp.op = op;
 
 	gsRenderOp.pDestPicture = pDstPicture;
@@ -1424,9 +3483,9 @@ sgxCheckComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 	}
 
 	if (!gsRenderOp.hCode) {
-		sgxWaitPixmap(gsRenderOp.pSrc);
-		sgxWaitPixmap(gsRenderOp.pDest);
-		sgxWaitPixmap(gsRenderOp.pMask);
+		sgxWaitPixmap(gsRenderOp.pSrc, FALSE);
+		sgxWaitPixmap(gsRenderOp.pDest, TRUE);
+		sgxWaitPixmap(gsRenderOp.pMask, FALSE);
 
 		return FALSE;
 	}
@@ -1439,6 +3498,20 @@ sgxPrepareComposite(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 		     PicturePtr pDstPicture, PixmapPtr pSrc, PixmapPtr pMask,
 		     PixmapPtr pDst)
 {
+	switch (gsRenderOp.fold) {
+	case PVR_FOLD_FILL:
+		gsRenderOp.pDest = pDst;
+		return sgxPrepareSolid(pDst, GXcopy, ~0, gsRenderOp.foldPixel);
+	case PVR_FOLD_NOOP:
+		gsRenderOp.pDest = pDst;
+		return TRUE;
+	default:
+		break;
+	}
+
+	sgxQueueFlush(pDst->drawable.pScreen);
+	sgxMapOpBegin(pDst->drawable.pScreen);
+
 	return TRUE;
 }
 
@@ -1489,7 +3562,7 @@ sgxCompositeNextBatch(ScreenPtr pScreen, IMG_BOOL lastBatch)
 	if (lastBatch) {
 		if (!gsRenderOp.numBltRects)
 			return FALSE;
-	} else if (gsRenderOp.numBltRects < MAX_COPY_BATCH_RECTS) {
+	} else if (gsRenderOp.numBltRects < MAX_RENDER_BATCH_RECTS) {
 		gsRenderOp.bltRectsIdx++;
 		return TRUE;
 	}
@@ -1514,9 +3587,394 @@ clamp(int *val, int low, int high)
 	return clamped;
 }
 
+/* pixman image of a picture, with the pixmap mapped for the CPU */
+static pixman_image_t *
+sgxPictureImage(PicturePtr pPicture, PixmapPtr pPixmap)
+{
+	OMAPPixmapPrivPtr pixmapPriv;
+	pixman_image_t *image;
+	char *map;
+	void *ptr;
+	int xoff, yoff;
+
+	if (!pPicture)
+		return NULL;
+
+	if (!pPixmap)
+		return image_from_pict(pPicture, FALSE, &xoff, &yoff);
+
+	pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
+	map = omap_bo_map(pixmapPriv->bo);
+
+	if (!map)
+		return NULL;
+
+	ptr = pPixmap->devPrivate.ptr;
+	pPixmap->devPrivate.ptr = map + pixmapPriv->offset;
+	image = image_from_pict(pPicture, FALSE, &xoff, &yoff);
+	pPixmap->devPrivate.ptr = ptr;
+
+	return image;
+}
+
+/* queue a dest rect with its source and mask rects */
 static void
-sgxComposite(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX, int maskY,
-	     int dstX, int dstY, int width, int height)
+sgxCompositeAddRect(ScreenPtr pScreen, SGXHW_RENDER_RECTS *src,
+		    SGXHW_RENDER_RECTS *mask, SGXHW_RENDER_RECTS *dst)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	IMG_INT bltRectsIdx = gsRenderOp.bltRectsIdx;
+	PVRBltRect *bltRects = &gsRenderOp.bltRects;
+
+	bltRects->destRect[bltRectsIdx] = *dst;
+	pvrAddRectToBoundingBox(&bltRects->destBoundBox,
+				&bltRects->destRect[bltRectsIdx],
+				&bltRects->destSurfaceBox);
+
+	bltRects->srcRect[bltRectsIdx] = *src;
+	pvrAddRectToBoundingBox(&bltRects->srcBoundBox,
+				&bltRects->srcRect[bltRectsIdx],
+				&bltRects->srcSurfaceBox);
+
+	if (gsRenderOp.pMask) {
+		bltRects->maskRect[bltRectsIdx] = *mask;
+		pvrAddRectToBoundingBox(&bltRects->maskBoundBox,
+					&bltRects->maskRect[bltRectsIdx],
+					&bltRects->maskSurfaceBox);
+	}
+
+	gsRenderOp.numBltRects++;
+
+	if (!sgxCompositeNextBatch(pScreen, FALSE))
+		ERROR_MSG("sgxComposite: GPU failed to perform composite operation!!!");
+}
+
+/* one rect composited by pixman, split into bands by OMAPBandsRun() */
+typedef struct PVRCompositeBand_TAG
+{
+	pixman_op_t op;
+	pixman_image_t *src, *mask, *dst;
+	int srcX, srcY;
+	int maskX, maskY;
+	int dstX, dstY;
+	int width;
+} PVRCompositeBand;
+
+static void
+sgxCompositeBand(void *closure, int y1, int y2)
+{
+	PVRCompositeBand *band = closure;
+
+	pixman_image_composite32(band->op, band->src, band->mask, band->dst,
+				 band->srcX, band->srcY + y1 - band->dstY,
+				 band->maskX, band->maskY + y1 - band->dstY,
+				 band->dstX, y1, band->width, y2 - y1);
+}
+
+/*
+ * Composite a rect the GPU can't do with pixman, after the GPU is done.
+ * Big ones are split over the worker threads, unless the source or mask
+ * is the destination, as bands would then read rows other bands write.
+ */
+static void
+sgxCompositeRectSW(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX,
+		   int maskY, int dstX, int dstY, int width, int height)
+{
+	PicturePtr pDestPicture = gsRenderOp.pDestPicture;
+	PicturePtr pMaskPicture = gsRenderOp.pMaskPicture;
+	PicturePtr pSrcPicture = gsRenderOp.pSrcPicture;
+	pixman_image_t *src, *mask, *dst;
+	PVRCompositeBand band;
+
+	sgxCompositeNextBatch(pDstPixmap->drawable.pScreen, TRUE);
+	sgxWaitPixmap(gsRenderOp.pSrc, FALSE);
+	sgxWaitPixmap(gsRenderOp.pMask, FALSE);
+	sgxWaitPixmap(pDstPixmap, TRUE);
+
+	src = sgxPictureImage(pSrcPicture, gsRenderOp.pSrc);
+	mask = sgxPictureImage(pMaskPicture, gsRenderOp.pMask);
+	dst = sgxPictureImage(pDestPicture, pDstPixmap);
+
+	if (!src || !dst || (pMaskPicture && !mask))
+		goto out;
+
+	band.op = gsRenderOp.op;
+	band.src = src;
+	band.mask = mask;
+	band.dst = dst;
+	band.srcX = srcX;
+	band.srcY = srcY;
+	band.maskX = maskX;
+	band.maskY = maskY;
+	band.dstX = dstX;
+	band.dstY = dstY;
+	band.width = width;
+
+	/* pixman sets the images up on first use, not from the workers */
+	pixman_image_composite32(band.op, src, mask, dst, 0, 0, 0, 0, 0, 0,
+				 0, 0);
+
+	if (gsRenderOp.pSrc == pDstPixmap || gsRenderOp.pMask == pDstPixmap)
+		sgxCompositeBand(&band, dstY, dstY + height);
+	else
+		OMAPBandsRun(pDstPixmap->drawable.pScreen, sgxCompositeBand,
+			     &band, dstY, dstY + height, width);
+
+out:
+	if (dst)
+		free_pixman_pict(pDestPicture, dst);
+	if (mask)
+		free_pixman_pict(pMaskPicture, mask);
+	if (src)
+		free_pixman_pict(pSrcPicture, src);
+}
+
+static inline int
+pvrMod(int a, int b)
+{
+	int m = a % b;
+
+	return m < 0 ? m + b : m;
+}
+
+/*
+ * Split len texels starting at start along one axis of a picture of the
+ * given size into spans reading a single run of texels.  Returns the
+ * number of spans, or -1 if there are too many or the GPU can't do it
+ * (reflected tiles, reads outside a non repeating picture).
+ */
+static int
+pvrRepeatSpans(PVRRepeatSpan *spans, int start, int len, int size,
+	       int repeat)
+{
+	int n = 0;
+	int pos;
+
+	/* one texel, every repeat mode stretches it */
+	if (size == 1 && repeat != RepeatNone) {
+		spans[0].dst = 0;
+		spans[0].src = 0;
+		spans[0].stretch = TRUE;
+		return 1;
+	}
+
+	switch (repeat) {
+	case RepeatNormal:
+		for (pos = 0; pos < len; n++) {
+			int src = pvrMod(start + pos, size);
+
+			if (n == PVR_REPEAT_MAX_SPANS)
+				return -1;
+
+			spans[n].dst = pos;
+			spans[n].src = src;
+			spans[n].stretch = FALSE;
+			pos += size - src;
+		}
+		return n;
+	case RepeatPad:
+		if (start < 0) {
+			spans[n].dst = 0;
+			spans[n].src = 0;
+			spans[n].stretch = TRUE;
+			n++;
+		}
+
+		if (start < size && start + len > 0) {
+			spans[n].dst = start < 0 ? -start : 0;
+			spans[n].src = start < 0 ? 0 : start;
+			spans[n].stretch = FALSE;
+			n++;
+		}
+
+		if (start + len > size) {
+			spans[n].dst = start < size ? size - start : 0;
+			spans[n].src = size - 1;
+			spans[n].stretch = TRUE;
+			n++;
+		}
+		return n;
+	default:
+		/* RepeatNone and RepeatReflect within the first tile */
+		if (start < 0 || start + len > size)
+			return -1;
+
+		spans[0].dst = 0;
+		spans[0].src = start;
+		spans[0].stretch = FALSE;
+		return 1;
+	}
+}
+
+/* texels of the span that cover [a, b) of the composite rect */
+static void
+pvrRepeatSpanMap(PVRRepeatSpan *span, int a, int b, IMG_INT32 *x0,
+		 IMG_INT32 *x1)
+{
+	if (span->stretch) {
+		*x0 = span->src;
+		*x1 = span->src + 1;
+	} else {
+		*x0 = span->src + a - span->dst;
+		*x1 = span->src + b - span->dst;
+	}
+}
+
+/* next span boundary after pos, or len */
+static int
+pvrRepeatSpanEnd(PVRRepeatSpan *spans, int n, int i, int len)
+{
+	return i + 1 < n ? spans[i + 1].dst : len;
+}
+
+/*
+ * Split a composite along one axis into the pieces where both the source
+ * and the mask read a single run of texels.  Returns the number of
+ * pieces, the source and mask texels of each are in src and mask.
+ */
+static int
+pvrRepeatPieces(PVRRepeatSpan *srcSpans, int srcCount,
+		PVRRepeatSpan *maskSpans, int maskCount, int len,
+		int *pieces, SGXHW_RENDER_RECTS *src, SGXHW_RENDER_RECTS *mask)
+{
+	int i = 0, j = 0, n = 0;
+	int pos = 0;
+
+	while (pos < len) {
+		int srcEnd = pvrRepeatSpanEnd(srcSpans, srcCount, i, len);
+		int maskEnd = maskCount ?
+			      pvrRepeatSpanEnd(maskSpans, maskCount, j, len) :
+			      len;
+		int end = srcEnd < maskEnd ? srcEnd : maskEnd;
+
+		if (n == PVR_REPEAT_MAX_SPANS * 2)
+			return -1;
+
+		pieces[n] = pos;
+		pvrRepeatSpanMap(&srcSpans[i], pos, end, &src[n].x0,
+				 &src[n].x1);
+
+		if (maskCount)
+			pvrRepeatSpanMap(&maskSpans[j], pos, end,
+					 &mask[n].x0, &mask[n].x1);
+
+		n++;
+		pos = end;
+
+		if (pos == srcEnd)
+			i++;
+		if (maskCount && pos == maskEnd)
+			j++;
+	}
+
+	pieces[n] = len;
+
+	return n;
+}
+
+/*
+ * Composite from a repeating source or mask by splitting the rect into
+ * one GPU rect per tile, so only whole runs of texels are read.  PAD
+ * edges stretch the outermost texels.  Rects that would need too many
+ * pieces, or reflected tiles, are done by pixman instead.  Returns FALSE
+ * if neither picture needs tiling.
+ */
+static Bool
+sgxCompositeTiled(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX,
+		  int maskY, int dstX, int dstY, int width, int height)
+{
+	PicturePtr pMaskPicture = gsRenderOp.pMaskPicture;
+	PicturePtr pSrcPicture = gsRenderOp.pSrcPicture;
+	PVRRepeatSpan srcXSpans[PVR_REPEAT_MAX_SPANS];
+	PVRRepeatSpan srcYSpans[PVR_REPEAT_MAX_SPANS];
+	PVRRepeatSpan maskXSpans[PVR_REPEAT_MAX_SPANS];
+	PVRRepeatSpan maskYSpans[PVR_REPEAT_MAX_SPANS];
+	int xPieces[PVR_REPEAT_MAX_SPANS * 2 + 1];
+	int yPieces[PVR_REPEAT_MAX_SPANS * 2 + 1];
+	/* texel runs of the pieces, x0 and x1 of the rows are y0 and y1 */
+	SGXHW_RENDER_RECTS srcCols[PVR_REPEAT_MAX_SPANS * 2];
+	SGXHW_RENDER_RECTS maskCols[PVR_REPEAT_MAX_SPANS * 2];
+	SGXHW_RENDER_RECTS srcRows[PVR_REPEAT_MAX_SPANS * 2];
+	SGXHW_RENDER_RECTS maskRows[PVR_REPEAT_MAX_SPANS * 2];
+	int nsx, nsy, nmx = 0, nmy = 0, cols, rows;
+	int i, j;
+
+	if (!sgxPictureTiled(pSrcPicture) && !sgxPictureTiled(pMaskPicture))
+		return FALSE;
+
+	if (pSrcPicture->transform || (pMaskPicture && pMaskPicture->transform))
+		goto sw;
+
+	nsx = pvrRepeatSpans(srcXSpans, srcX, width,
+			     pSrcPicture->pDrawable->width,
+			     pSrcPicture->repeatType);
+	nsy = pvrRepeatSpans(srcYSpans, srcY, height,
+			     pSrcPicture->pDrawable->height,
+			     pSrcPicture->repeatType);
+
+	if (pMaskPicture) {
+		nmx = pvrRepeatSpans(maskXSpans, maskX, width,
+				     pMaskPicture->pDrawable->width,
+				     pMaskPicture->repeatType);
+		nmy = pvrRepeatSpans(maskYSpans, maskY, height,
+				     pMaskPicture->pDrawable->height,
+				     pMaskPicture->repeatType);
+	}
+
+	if (nsx < 0 || nsy < 0 || nmx < 0 || nmy < 0)
+		goto sw;
+
+	cols = pvrRepeatPieces(srcXSpans, nsx, maskXSpans, nmx, width, xPieces,
+			       srcCols, maskCols);
+	rows = pvrRepeatPieces(srcYSpans, nsy, maskYSpans, nmy, height, yPieces,
+			       srcRows, maskRows);
+
+	if (cols < 0 || rows < 0 || cols * rows > PVR_REPEAT_MAX_RECTS)
+		goto sw;
+
+	for (j = 0; j < rows; j++) {
+		for (i = 0; i < cols; i++) {
+			SGXHW_RENDER_RECTS src, mask = { 0 }, dst;
+
+			dst.x0 = dstX + xPieces[i];
+			dst.x1 = dstX + xPieces[i + 1];
+			dst.y0 = dstY + yPieces[j];
+			dst.y1 = dstY + yPieces[j + 1];
+
+			src.x0 = srcCols[i].x0;
+			src.x1 = srcCols[i].x1;
+			src.y0 = srcRows[j].x0;
+			src.y1 = srcRows[j].x1;
+
+			if (pMaskPicture) {
+				mask.x0 = maskCols[i].x0;
+				mask.x1 = maskCols[i].x1;
+				mask.y0 = maskRows[j].x0;
+				mask.y1 = maskRows[j].x1;
+			}
+
+			/* PAD edges, the atlas blit can't do those */
+			if (src.x1 - src.x0 != dst.x1 - dst.x0 ||
+			    src.y1 - src.y0 != dst.y1 - dst.y0)
+				gsRenderOp.stretched = TRUE;
+
+			sgxCompositeAddRect(pDstPixmap->drawable.pScreen,
+					    &src, &mask, &dst);
+		}
+	}
+
+	return TRUE;
+
+sw:
+	sgxCompositeRectSW(pDstPixmap, srcX, srcY, maskX, maskY, dstX, dstY,
+			   width, height);
+
+	return TRUE;
+}
+
+static void
+sgxCompositeRect(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX,
+		 int maskY, int dstX, int dstY, int width, int height)
 {
 	PicturePtr pDestPicture = gsRenderOp.pDestPicture;
 	PicturePtr pMaskPicture = gsRenderOp.pMaskPicture;
@@ -1528,25 +3986,25 @@ sgxComposite(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX, int maskY,
 	int iRealMaskHeight = height;
 	int iRealDestHeight = height;
 	int iRealSrcHeight = height;
-	IMG_INT bltRectsIdx = gsRenderOp.bltRectsIdx;
-	ScreenPtr pScreen = pDstPixmap->drawable.pScreen;
-	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
-	SGXHW_RENDER_RECTS *destRect;
-	SGXHW_RENDER_RECTS *srcRect;
+	ScrnInfoPtr pScrn = pix2scrn(pDstPixmap);
+	SGXHW_RENDER_RECTS destRect, srcRect, maskRect;
 
-	if (pMaskPicture)
-		badMask = pMaskPicture->transform != NULL;
+	if (sgxCompositeTiled(pDstPixmap, srcX, srcY, maskX, maskY, dstX, dstY,
+			      width, height))
+		return;
 
 	if (pSrcPicture->transform) {
 		PVRApplyTransformation(pSrcPicture->transform, &srcX, &srcY,
 				       &iRealSrcWidth, &iRealSrcHeight);
 	}
 
+	/* 1x1 repeats, cached solid pictures among them, are stretched */
 	if (pSrcPicture->repeatType != RepeatNone) {
 		srcX = 0;
 		srcY = 0;
 		iRealSrcWidth = 1;
 		iRealSrcHeight = 1;
+		gsRenderOp.stretched = TRUE;
 	} else {
 		int h = pSrcPicture->pDrawable->height;
 		int w = pSrcPicture->pDrawable->width;
@@ -1605,48 +4063,271 @@ sgxComposite(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX, int maskY,
 		return;
 	}
 
-	destRect = &gsRenderOp.bltRects.destRect[bltRectsIdx];
-	destRect->x0 = dstX;
-	destRect->x1 = dstX + iRealDestWidth;
-	destRect->y0 = dstY;
-	destRect->y1 = dstY + iRealDestHeight;
-	pvrAddRectToBoundingBox(&gsRenderOp.bltRects.destBoundBox, destRect,
-				&gsRenderOp.bltRects.destSurfaceBox);
+	destRect.x0 = dstX;
+	destRect.x1 = dstX + iRealDestWidth;
+	destRect.y0 = dstY;
+	destRect.y1 = dstY + iRealDestHeight;
 
-	srcRect = &gsRenderOp.bltRects.srcRect[bltRectsIdx];
-	srcRect->x0 = srcX;
-	srcRect->x1 = srcX + iRealSrcWidth;
-	srcRect->y0 = srcY;
-	srcRect->y1 = srcY + iRealSrcHeight;
-	pvrAddRectToBoundingBox(&gsRenderOp.bltRects.srcBoundBox, srcRect,
-				&gsRenderOp.bltRects.srcSurfaceBox);
+	srcRect.x0 = srcX;
+	srcRect.x1 = srcX + iRealSrcWidth;
+	srcRect.y0 = srcY;
+	srcRect.y1 = srcY + iRealSrcHeight;
 
-	if (gsRenderOp.pMask) {
-		SGXHW_RENDER_RECTS *maskRect =
-				&gsRenderOp.bltRects.maskRect[bltRectsIdx];
+	maskRect.x0 = maskX;
+	maskRect.x1 = maskX + iRealMaskWidth;
+	maskRect.y0 = maskY;
+	maskRect.y1 = maskY + iRealMaskHeight;
 
-		maskRect->x0 = maskX;
-		maskRect->x1 = maskX + iRealMaskWidth;
-		maskRect->y0 = maskY;
-		maskRect->y1 = maskY + iRealMaskHeight;
-		pvrAddRectToBoundingBox(&gsRenderOp.bltRects.maskBoundBox,
-					maskRect,
-					&gsRenderOp.bltRects.maskSurfaceBox);
+	sgxCompositeAddRect(pDstPixmap->drawable.pScreen, &srcRect, &maskRect,
+			    &destRect);
+}
+
+/* r5g6b5 pixels with a channel more than tolerance steps apart */
+static inline Bool
+pvrRgb565Differ(uint16_t a, uint16_t b, int tolerance)
+{
+	return abs((a >> 11) - (b >> 11)) > tolerance ||
+	       abs(((a >> 5) & 0x3f) - ((b >> 5) & 0x3f)) > tolerance ||
+	       abs((a & 0x1f) - (b & 0x1f)) > tolerance;
+}
+
+/*
+ * Count the pixels of a rendered rect that differ from pixman's.  Channels
+ * may be off by tolerance, the GPU rounds differently.  The unused channel
+ * of x8r8g8b8 formats is not compared.
+ */
+static unsigned int
+sgxCompareImages(pixman_image_t *image, int x, int y, pixman_image_t *shadow,
+		 PictFormatShort format, int width, int height, int tolerance)
+{
+	int bpp = PICT_FORMAT_BPP(format);
+	int bytes = bpp == 32 && !PICT_FORMAT_A(format) ? 3 : bpp / 8;
+	int stride = pixman_image_get_stride(image);
+	int shadowStride = pixman_image_get_stride(shadow);
+	uint8_t *row = (uint8_t *)pixman_image_get_data(image) + y * stride +
+		       x * bpp / 8;
+	uint8_t *shadowRow = (uint8_t *)pixman_image_get_data(shadow);
+	unsigned int mismatches = 0;
+	int i, j, k;
+
+	for (j = 0; j < height; j++) {
+		for (i = 0; i < width; i++) {
+			uint8_t *p = row + i * bpp / 8;
+			uint8_t *q = shadowRow + i * bpp / 8;
+
+			if (format == PICT_r5g6b5) {
+				if (pvrRgb565Differ(*(uint16_t *)p,
+						    *(uint16_t *)q, tolerance))
+					mismatches++;
+				continue;
+			}
+
+			/* little endian, the x channel is the last byte */
+			for (k = 0; k < bytes; k++) {
+				if (abs(p[k] - q[k]) > tolerance) {
+					mismatches++;
+					break;
+				}
+			}
+		}
+
+		row += stride;
+		shadowRow += shadowStride;
 	}
 
-	gsRenderOp.numBltRects++;
+	return mismatches;
+}
 
-	if (!sgxCompositeNextBatch(pScreen, FALSE))
-		ERROR_MSG("sgxComposite: GPU failed to perform composite operation!!!");
+/*
+ * HWCompositeCheck: render the rect with pixman into a shadow of the
+ * destination, then on the GPU, and compare.  Every rect is submitted and
+ * waited for on its own, so the GPU time includes the submission.
+ */
+static void
+sgxCompositeCheck(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX,
+		  int maskY, int dstX, int dstY, int width, int height)
+{
+	ScreenPtr pScreen = pDstPixmap->drawable.pScreen;
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+	PicturePtr pDestPicture = gsRenderOp.pDestPicture;
+	PicturePtr pMaskPicture = gsRenderOp.pMaskPicture;
+	PicturePtr pSrcPicture = gsRenderOp.pSrcPicture;
+	pixman_image_t *src, *mask, *dst, *shadow;
+	struct timeval start, sw, hw;
+	unsigned int mismatches = 0;
+
+	/* the shadow starts from what earlier GPU rects left there */
+	sgxCompositeNextBatch(pScreen, TRUE);
+	sgxWaitPixmap(gsRenderOp.pSrc, FALSE);
+	sgxWaitPixmap(gsRenderOp.pMask, FALSE);
+	sgxWaitPixmap(pDstPixmap, TRUE);
+
+	src = sgxPictureImage(pSrcPicture, gsRenderOp.pSrc);
+	mask = sgxPictureImage(pMaskPicture, gsRenderOp.pMask);
+	dst = sgxPictureImage(pDestPicture, pDstPixmap);
+	shadow = pixman_image_create_bits(pDestPicture->format, width, height,
+					  NULL, 0);
+
+	if (!src || !dst || !shadow || (pMaskPicture && !mask)) {
+		sgxCompositeRect(pDstPixmap, srcX, srcY, maskX, maskY, dstX,
+				 dstY, width, height);
+		goto out;
+	}
+
+	pixman_image_composite32(PIXMAN_OP_SRC, dst, NULL, shadow, dstX, dstY,
+				 0, 0, 0, 0, width, height);
+
+	gettimeofday(&start, NULL);
+	pixman_image_composite32(gsRenderOp.op, src, mask, shadow, srcX, srcY,
+				 maskX, maskY, 0, 0, width, height);
+	gettimeofday(&sw, NULL);
+
+	sgxCompositeRect(pDstPixmap, srcX, srcY, maskX, maskY, dstX, dstY,
+			 width, height);
+	sgxCompositeNextBatch(pScreen, TRUE);
+	sgxWaitPixmap(pDstPixmap, FALSE);
+	gettimeofday(&hw, NULL);
+
+	mismatches = sgxCompareImages(dst, dstX, dstY, shadow,
+				      pDestPicture->format, width, height, 1);
+
+	pPVR->check_count++;
+
+	if (mismatches) {
+		pPVR->check_mismatch++;
+		WARNING_MSG("composite %s %08x <- %08x / %08x %dx%d: %u pixels differ",
+			    sgxCompositeOpNames[gsRenderOp.op],
+			    pDestPicture->format, pSrcPicture->format,
+			    pMaskPicture ? pMaskPicture->format : 0,
+			    width, height, mismatches);
+	}
+
+	DEBUG_MSG("composite %s %08x <- %08x / %08x %dx%d: pixman %lu us, SGX %lu us",
+		  sgxCompositeOpNames[gsRenderOp.op], pDestPicture->format,
+		  pSrcPicture->format, pMaskPicture ? pMaskPicture->format : 0,
+		  width, height, sgxElapsed(&start, &sw), sgxElapsed(&sw, &hw));
+
+out:
+	if (shadow)
+		pixman_image_unref(shadow);
+	if (dst)
+		free_pixman_pict(pDestPicture, dst);
+	if (mask)
+		free_pixman_pict(pMaskPicture, mask);
+	if (src)
+		free_pixman_pict(pSrcPicture, src);
+}
+
+/*
+ * HWCompositeCheck of a folded composite: pixman renders the rect, which
+ * has to come out exactly as the fill colour, or for a dropped composite
+ * as the destination that is left alone.  Done before the fill.
+ */
+static void
+sgxCompositeCheckFold(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX,
+		      int maskY, int dstX, int dstY, int width, int height)
+{
+	ScrnInfoPtr pScrn = pix2scrn(pDstPixmap);
+	PVRPtr pPVR = PVREXAPTR(pScrn);
+	PicturePtr pDestPicture = gsRenderOp.pDestPicture;
+	PicturePtr pMaskPicture = gsRenderOp.pMaskPicture;
+	PicturePtr pSrcPicture = gsRenderOp.pSrcPicture;
+	PictFormatShort format = pDestPicture->format;
+	pixman_image_t *src, *mask, *dst, *shadow, *folded;
+	unsigned int mismatches;
+
+	sgxWaitPixmap(gsRenderOp.pSrc, FALSE);
+	sgxWaitPixmap(gsRenderOp.pMask, FALSE);
+	sgxWaitPixmap(pDstPixmap, FALSE);
+
+	src = sgxPictureImage(pSrcPicture, gsRenderOp.pSrc);
+	mask = sgxPictureImage(pMaskPicture, gsRenderOp.pMask);
+	dst = sgxPictureImage(pDestPicture, pDstPixmap);
+	shadow = pixman_image_create_bits(format, width, height, NULL, 0);
+	folded = pixman_image_create_bits(format, width, height, NULL, 0);
+
+	if (!src || !dst || !shadow || !folded || (pMaskPicture && !mask))
+		goto out;
+
+	pixman_image_composite32(PIXMAN_OP_SRC, dst, NULL, shadow, dstX, dstY,
+				 0, 0, 0, 0, width, height);
+	pixman_image_composite32(gsRenderOp.op, src, mask, shadow, srcX, srcY,
+				 maskX, maskY, 0, 0, width, height);
+
+	if (gsRenderOp.fold == PVR_FOLD_FILL)
+		pixman_fill(pixman_image_get_data(folded),
+			    pixman_image_get_stride(folded) / sizeof(uint32_t),
+			    PICT_FORMAT_BPP(format), 0, 0, width, height,
+			    gsRenderOp.foldPixel);
+	else
+		pixman_image_composite32(PIXMAN_OP_SRC, dst, NULL, folded,
+					 dstX, dstY, 0, 0, 0, 0, width, height);
+
+	mismatches = sgxCompareImages(folded, 0, 0, shadow, format, width,
+				      height, 0);
+
+	pPVR->check_count++;
+
+	if (mismatches) {
+		pPVR->check_mismatch++;
+		WARNING_MSG("folded composite %s %08x <- %08x / %08x %dx%d: %u pixels differ",
+			    sgxCompositeOpNames[gsRenderOp.op], format,
+			    pSrcPicture->format,
+			    pMaskPicture ? pMaskPicture->format : 0,
+			    width, height, mismatches);
+	}
+
+out:
+	if (folded)
+		pixman_image_unref(folded);
+	if (shadow)
+		pixman_image_unref(shadow);
+	if (dst)
+		free_pixman_pict(pDestPicture, dst);
+	if (mask)
+		free_pixman_pict(pMaskPicture, mask);
+	if (src)
+		free_pixman_pict(pSrcPicture, src);
+}
+
+static void
+sgxComposite(PixmapPtr pDstPixmap, int srcX, int srcY, int maskX, int maskY,
+	     int dstX, int dstY, int width, int height)
+{
+	PVRPtr pPVR = PVREXAPTR(pix2scrn(pDstPixmap));
+
+	if (gsRenderOp.fold != PVR_FOLD_NONE && pPVR->composite_check)
+		sgxCompositeCheckFold(pDstPixmap, srcX, srcY, maskX, maskY,
+				      dstX, dstY, width, height);
+
+	if (gsRenderOp.fold == PVR_FOLD_FILL)
+		sgxSolid(pDstPixmap, dstX, dstY, dstX + width, dstY + height);
+	else if (gsRenderOp.fold == PVR_FOLD_NOOP)
+		return;
+	else if (pPVR->composite_check)
+		sgxCompositeCheck(pDstPixmap, srcX, srcY, maskX, maskY, dstX,
+				  dstY, width, height);
+	else
+		sgxCompositeRect(pDstPixmap, srcX, srcY, maskX, maskY, dstX,
+				 dstY, width, height);
 }
 
 static void
 sgxDoneComposite(PixmapPtr pDst)
 {
+	if (gsRenderOp.fold != PVR_FOLD_NONE) {
+		if (gsRenderOp.fold == PVR_FOLD_FILL)
+			sgxDoneSolid(pDst);
+
+		gsRenderOp.fold = PVR_FOLD_NONE;
+		gsRenderOp.pDest = NULL;
+		return;
+	}
+
 	sgxCompositeNextBatch(pDst->drawable.pScreen, TRUE);
 
-	setPixmapOnGPU(pDst);
-	flushScanout(pDst);
+	sgxQueueScanout(PVREXAPTR(pix2scrn(pDst)), pDst);
 
 	gsRenderOp.pDest = NULL;
 	gsRenderOp.hCode = NULL;
@@ -1709,7 +4390,8 @@ sgxAccelInit(ScreenPtr pScreen, PVRPtr pPVR, int fd)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 
-	sgxCacheInit(pPVR);
+	sgxCacheInit(pScrn, pPVR);
+	sgxCompositeInit(pScrn, pPVR);
 	PVRInitServices(pScrn);
 
 	if (!InitialiseServices(pScreen, &pPVR->srv)) {
@@ -1717,6 +4399,16 @@ sgxAccelInit(ScreenPtr pScreen, PVRPtr pPVR, int fd)
 		return FALSE;
 	}
 
+	/* GPUMapSize can only lower the limit */
+	if (!pPVR->map_max_size ||
+	    pPVR->map_max_size > pPVR->srv->mapping_heap_size / 100 *
+	    PVR_MAP_HEAP_PERCENT) {
+		pPVR->map_max_size = pPVR->srv->mapping_heap_size / 100 *
+				     PVR_MAP_HEAP_PERCENT;
+	}
+
+	INFO_MSG("GPU mappings limited to %lu KiB", pPVR->map_max_size / 1024);
+
 	if (!PVRUseInit(pScreen, pPVR))
 		return FALSE;
 
@@ -1743,13 +4435,60 @@ static Bool
 sgxPrepareAccess(PixmapPtr pPixmap, int index)
 {
 	OMAPPixmapPrivPtr priv = exaGetPixmapDriverPrivate(pPixmap);
+	char *map = omap_bo_map(priv->bo);
+
+	if (!map)
+		return FALSE;
+
+	sgxQueueFlush(pPixmap->drawable.pScreen);
+
+	pPixmap->devPrivate.ptr = map + priv->offset;
+
+	/* the GPU may go on reading what the CPU only reads */
+	sgxWaitPixmap(pPixmap, index != EXA_PREPARE_SRC &&
+			       index != EXA_PREPARE_MASK);
+
+	return TRUE;
+}
+
+/* DRI2 clients need a BO of their own, move the pixmap out of its slab */
+static Bool
+sgxExportPixmap(PixmapPtr pPixmap)
+{
+	ScrnInfoPtr pScrn = pix2scrn(pPixmap);
+	ScreenPtr pScreen = pPixmap->drawable.pScreen;
+	OMAPPtr pOMAP = OMAPPTR(pScrn);
+	OMAPPixmapPrivPtr priv = exaGetPixmapDriverPrivate(pPixmap);
+	uint32_t size = pPixmap->devKind * pPixmap->drawable.height;
+	struct omap_bo *bo;
+	char *src, *dst;
+
+	if (!sgxPixmapInSlab(priv))
+		return TRUE;
+
+	sgxQueueFlush(pScreen);
+
+	bo = omap_bo_new(pOMAP->dev, (size + (4096 - 1)) & ~(4096 - 1),
+			 OMAP_BO_WC);
+
+	if (!bo)
+		return FALSE;
 
-	pPixmap->devPrivate.ptr = omap_bo_map(priv->bo);
+	src = omap_bo_map(priv->bo);
+	dst = omap_bo_map(bo);
 
-	if (!pPixmap->devPrivate.ptr)
+	if (!src || !dst) {
+		omap_bo_del(bo);
 		return FALSE;
+	}
+
+	sgxWaitPixmap(pPixmap, FALSE);
+	memcpy(dst, src + priv->offset, size);
 
-	sgxWaitPixmap(pPixmap);
+	sgxSlabFree(pScreen, priv);
+	priv->bo = bo;
+	priv->flags = OMAP_BO_WC;
+	priv->tiled = FALSE;
 
 	return TRUE;
 }
@@ -1822,6 +4561,9 @@ InitPowerVREXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 	omap_exa->PutTextureImage = PUT_TEXTURE_IMAGE_FN;
 	omap_exa->CloseScreen = CloseScreen;
 	omap_exa->FreeScreen = FreeScreen;
+	omap_exa->BlockHandler = BlockHandler;
+	omap_exa->ExportPixmap = sgxExportPixmap;
+	omap_exa->PixmapPinned = sgxPixmapPinned;
 
 	return omap_exa;
 
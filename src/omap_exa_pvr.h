@@ -30,11 +30,51 @@ typedef struct
 	PVRSRV_DEV_DATA dev_data;
 	IMG_HANDLE h_dev_mem_context;
 	IMG_HANDLE h_mapping_heap;
+	IMG_UINT32 mapping_heap_size;
 	PVRSRV_MISC_INFO misc_info;
 	PVR2DCONTEXTHANDLE hPVR2DContext;
 } PVRSERVICES, *PPVRSERVICES;
 
 /* #define INSTRUMENT_BO_CACHE */
+
+/*
+ * Cached BOs are kept in per page count size classes, BOs bigger than
+ * PVR_BO_CACHE_BUCKETS pages all go to the last (overflow) bucket.
+ */
+#define PVR_BO_CACHE_BUCKETS 256
+#define PVR_BO_CACHE_MASK_WORDS ((PVR_BO_CACHE_BUCKETS + 1 + 31) / 32)
+
+/*
+ * Pixmaps up to PVR_SLAB_MAX_PIXMAP bytes are packed into shared slab BOs,
+ * in PVR_SLAB_CHUNK granules.
+ */
+#define PVR_SLAB_SIZE (64 * 1024)
+#define PVR_SLAB_CHUNK 256
+#define PVR_SLAB_CHUNKS (PVR_SLAB_SIZE / PVR_SLAB_CHUNK)
+#define PVR_SLAB_MAX_PIXMAP 2048
+
+/* 1x1 repeating pictures kept for solid fill sources and masks */
+#define PVR_SOLID_CACHE_SIZE 64
+
+/* GPU mappings waiting to be unmapped from the block handler */
+#define PVR_UNMAP_QUEUE_SIZE 64
+
+/* batch left open by the last Done* call, see sgxQueueFlush() */
+typedef enum
+{
+	PVR_QUEUE_NONE = 0,
+	PVR_QUEUE_SOLID,
+	PVR_QUEUE_COPY
+} PVRQueueOp;
+
+/* destination format classes HW compositing is enabled for, per op */
+#define PVR_COMPOSITE_A8	(1 << 0)
+#define PVR_COMPOSITE_XRGB	(1 << 1)
+#define PVR_COMPOSITE_ARGB	(1 << 2)
+#define PVR_COMPOSITE_RGB565	(1 << 3)
+#define PVR_COMPOSITE_ALL	(PVR_COMPOSITE_A8 | PVR_COMPOSITE_XRGB | \
+				 PVR_COMPOSITE_ARGB | PVR_COMPOSITE_RGB565)
+
 typedef struct PVR
 {
 	OMAPEXARec base;
@@ -44,30 +84,130 @@ typedef struct PVR
 	/* LRU BO maps */
 	struct xorg_list map_list;
 	unsigned long map_count;
-	/* cached BOs, i.e */
+	/* bytes of general heap mapped by map_list entries, and the limit */
+	unsigned long map_size;
+	unsigned long map_max_size;
+	unsigned long map_hit;
+	unsigned long map_miss;
+	/* misses on BOs we had to unmap before */
+	unsigned long map_remap;
+	/* small fill batches done by the CPU instead */
+	unsigned long sw_fills;
+	/* PVR_COMPOSITE_* classes the GPU composites, by Render op */
+	unsigned int hw_composite[PictOpSaturate + 1];
+	/* check GPU composites against pixman, and the results so far */
+	Bool composite_check;
+	unsigned long check_count;
+	unsigned long check_mismatch;
+	/* dropped mappings, unmapped once the GPU is done with them */
+	PVR2DMEMINFO unmap_queue[PVR_UNMAP_QUEUE_SIZE];
+	unsigned int unmap_count;
+	/* solid or copy batch not submitted yet */
+	PVRQueueOp queued;
+	/* operation being prepared, its mappings stay */
+	unsigned long op_serial;
+	/* scanout pixmap the display has to be told about */
+	PixmapPtr scanout_dirty;
+	/* slabs small pixmaps are sub-allocated from */
+	struct xorg_list slab_list;
+	unsigned long slab_count;
+	/* solid pictures, LRU order */
+	struct xorg_list solid_list;
+	unsigned int solid_count;
+	/* recycled PrivPixmapRec's and BoCacheEntryRec's */
+	OMAPPoolRec priv_pool;
+	OMAPPoolRec entry_pool;
+	/* exported dma-buf fds kept open, LRU order */
+	struct xorg_list fd_list;
+	unsigned long fd_count;
+	unsigned long fd_max;
+	/* cached BOs, LRU order */
 	struct xorg_list bo_list;
+	/* cached BOs, by size class, with a bitmap of non-empty buckets */
+	struct xorg_list bo_bucket[PVR_BO_CACHE_BUCKETS + 1];
+	uint32_t bo_bucket_mask[PVR_BO_CACHE_MASK_WORDS];
 	unsigned long bo_count;
 	unsigned long bo_size;
-#ifdef INSTRUMENT_BO_CACHE
+	/* current size limit, follows the recent demand up to bo_max_size */
+	unsigned long bo_budget;
+	unsigned long bo_max_size;
+	/* bytes asked from the cache, halved every bo_timeout ms */
+	unsigned long bo_demand;
+	CARD32 bo_demand_time;
+	/* ms an unused BO stays in the cache */
+	CARD32 bo_timeout;
+	/* percent a reused BO may exceed the requested size */
+	unsigned int bo_tolerance;
+	/* cached tiled, scanout and Xv BOs, LRU order, separate budget */
+	struct xorg_list sbo_list;
+	unsigned long sbo_count;
+	unsigned long sbo_size;
+	unsigned long sbo_max_size;
 	unsigned long bo_cache_hit;
 	unsigned long bo_cache_miss;
-#endif
+	/* bytes handed out above the requested (page rounded) sizes */
+	unsigned long long bo_cache_waste;
 } PVRRec, *PVRPtr;
 
+/* what a tiled, scanout or Xv BO was allocated for */
+typedef struct BoCacheKey
+{
+	int usage_hint;
+	int width;
+	int height;
+	int bitsPerPixel;
+} BoCacheKeyRec, *BoCacheKeyPtr;
+
+struct PVRSlab;
+
 typedef struct PrivPixmap
 {
 	PVR2DMEMINFO meminfo;
 	struct xorg_list map;
-	Bool is_gpu;
+	/* used by a DRI2 buffer, never unmapped by the LRU */
+	Bool pinned;
+	/* last operation that took the mapping, see sgxMapOpBegin() */
+	unsigned long op;
+	/* unmapped by the LRU, next map is a remap */
+	Bool evicted;
+	/* dma-buf of the BO, -1 if not exported */
+	int fd;
+	struct xorg_list fd_list;
+	BoCacheKeyRec key;
+	/* set if the BO is a slab shared by several pixmaps */
+	struct PVRSlab *slab;
 } PrivPixmapRec, *PrivPixmapPtr;
 
+typedef struct PVRSlab
+{
+	struct omap_bo *bo;
+	PrivPixmapPtr priv;
+	uint32_t used[PVR_SLAB_CHUNKS / 32];
+	/* chunks of the pixmap starting at that chunk */
+	uint8_t len[PVR_SLAB_CHUNKS];
+	unsigned int free_chunks;
+	struct xorg_list list;
+} PVRSlabRec, *PVRSlabPtr;
+
 typedef struct BoCacheEntry
 {
 	struct omap_bo *bo;
 	PrivPixmapPtr priv;
+	uint32_t pages;
+	Bool tiled;
+	CARD32 time;
 	struct xorg_list list;
+	struct xorg_list bucket;
 } BoCacheEntryRec, *BoCacheEntryPtr;
 
+typedef struct PVRSolidPicture
+{
+	CARD32 color;
+	PixmapPtr pPixmap;
+	PicturePtr pPicture;
+	struct xorg_list list;
+} PVRSolidPictureRec, *PVRSolidPicturePtr;
+
 typedef enum
 {
 	SURFACE_BUFF_ACCESS_UNKNOWN = 0x0,
@@ -92,6 +232,8 @@ typedef IMG_RECT SGXHW_RENDER_RECTS;
 
 #define MAX_SOLID_BATCH_RECTS 128
 #define MAX_COPY_BATCH_RECTS 51
+/* a run of glyphs from EXA's glyph cache goes out as one atlas blit */
+#define MAX_RENDER_BATCH_RECTS 256
 
 typedef struct PVRSolidOp_TAG
 {
@@ -111,6 +253,13 @@ typedef struct PVRSolidOp_TAG
 	IMG_INT bltRectsIdx;
 	IMG_INT numBltRects;
 	Bool handleDestDamage;
+	/* filling overlapping rects once gives the same result */
+	Bool idempotent;
+	int alu;
+	Pixel fg;
+	/* the fill can be done by pixman_fill() with swColour */
+	Bool swFill;
+	Pixel swColour;
 } PVRSolidOp, *PPVRSolidOp;
 
 typedef enum
@@ -125,9 +274,9 @@ typedef enum
 
 typedef struct PVRBltRect_TAG
 {
-	SGXHW_RENDER_RECTS destRect[MAX_COPY_BATCH_RECTS];
-	SGXHW_RENDER_RECTS srcRect[MAX_COPY_BATCH_RECTS];
-	SGXHW_RENDER_RECTS maskRect[MAX_COPY_BATCH_RECTS];
+	SGXHW_RENDER_RECTS destRect[MAX_RENDER_BATCH_RECTS];
+	SGXHW_RENDER_RECTS srcRect[MAX_RENDER_BATCH_RECTS];
+	SGXHW_RENDER_RECTS maskRect[MAX_RENDER_BATCH_RECTS];
 	SGXHW_RENDER_RECTS destBoundBox;
 	SGXHW_RENDER_RECTS srcBoundBox;
 	SGXHW_RENDER_RECTS maskBoundBox;
@@ -144,6 +293,26 @@ typedef enum
 	SGXTQ_RENDER_RECTS_REPEAT_REFLECT = 0x3,
 } SGXHW_RENDER_RECTS_REPEAT_TYPE;
 
+/* rects a repeating picture is split into, per axis and per composite */
+#define PVR_REPEAT_MAX_SPANS 16
+#define PVR_REPEAT_MAX_RECTS 64
+
+/* part of a composite rect that reads one tile of a repeating picture */
+typedef struct PVRRepeatSpan_TAG
+{
+	int dst;		/* offset in the composite rect */
+	int src;		/* first texel in the picture */
+	Bool stretch;		/* one texel stretched over the span */
+} PVRRepeatSpan;
+
+/* what a composite with solid source and mask comes down to */
+typedef enum
+{
+	PVR_FOLD_NONE = 0,
+	PVR_FOLD_FILL,		/* a solid fill with foldPixel */
+	PVR_FOLD_NOOP		/* leaves the destination alone */
+} PVRCompositeFold;
+
 typedef struct PVRRenderOp_TAG
 {
 	PicturePtr pSrcPicture;
@@ -171,6 +340,10 @@ typedef struct PVRRenderOp_TAG
 	PVR2D_HANDLE hCode;
 	RENDER_TRANSFORMATION transform;
 	Bool handleDestDamage;
+	PVRCompositeFold fold;
+	Pixel foldPixel;
+	/* a source rect of the batch is smaller than its dest rect */
+	Bool stretched;
 } PVRRenderOp, *PPVRRenderOp;
 
 typedef struct PVRCopyOp_TAG
@@ -182,6 +355,11 @@ typedef struct PVRCopyOp_TAG
 	};
 
 	PVRRenderOp renderOp;
+	/* src - dst offset shared by all rects of the batch */
+	int dx, dy;
+	Bool sameDelta;
+	Bool idempotent;
+	int alu;
 } PVRCopyOp, *PPVRCopyOp;
 
 const char *sgxErrorCodeToString(PVR2DERROR err);
@@ -195,7 +373,8 @@ PVREXAPTR(ScrnInfoPtr pScrn)
 void sgxUnmapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv);
 PrivPixmapPtr sgxMapPixmapBo(ScreenPtr pScreen, OMAPPixmapPrivPtr pixmapPriv);
 
-void setPixmapOnGPU(PixmapPtr pPixmap);
 void flushScanout(PixmapPtr pPixmap);
+void sgxQueueFlush(ScreenPtr pScreen);
+void sgxMapOpBegin(ScreenPtr pScreen);
 
 #endif /* __OMAP_EXA_PVR_H__ */
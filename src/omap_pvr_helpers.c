@@ -104,6 +104,7 @@ InitialiseServices(ScreenPtr pScreen, PPVRSERVICES *pSrv)
 	for (i = 0; i < heap_count; i++) {
 		if (HEAP_IDX(heap_info[i].ui32HeapID) == SGX_GENERAL_HEAP_ID) {
 			gsSrv.h_mapping_heap = heap_info[i].hDevMemHeap;
+			gsSrv.mapping_heap_size = heap_info[i].ui32HeapByteSize;
 			break;
 		}
 	}
@@ -192,13 +193,11 @@ DeInitialiseServices(ScreenPtr pScreen, PPVRSERVICES pSrv)
 	}
 }
 
-IMG_BOOL
-PVRMapBo(ScreenPtr pScreen, PPVRSERVICES pSrv, int drmFD, struct omap_bo *bo,
-	 PPVR2DMEMINFO meminfo)
+/* returns a dma-buf fd for the BO, the caller has to close it */
+int
+PVRExportBo(ScreenPtr pScreen, int drmFD, struct omap_bo *bo)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
-	PVRSRV_ERROR err;
-	PPVRSRV_CLIENT_MEM_INFO psClientMemInfo;
 	struct drm_prime_handle req = {
 		.handle = omap_bo_handle(bo),
 		.flags = DRM_CLOEXEC,
@@ -207,21 +206,30 @@ PVRMapBo(ScreenPtr pScreen, PPVRSERVICES pSrv, int drmFD, struct omap_bo *bo,
 	if (drmIoctl(drmFD, DRM_IOCTL_PRIME_HANDLE_TO_FD, &req)) {
 		ERROR_MSG("DRM_IOCTL_PRIME_HANDLE_TO_FD failed: %s(%d)",
 			  strerror(errno), errno);
-		return IMG_FALSE;
+		return -1;
 	}
 
+	return req.fd;
+}
+
+IMG_BOOL
+PVRMapBo(ScreenPtr pScreen, PPVRSERVICES pSrv, int fd, struct omap_bo *bo,
+	 PPVR2DMEMINFO meminfo)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	PVRSRV_ERROR err;
+	PPVRSRV_CLIENT_MEM_INFO psClientMemInfo;
+
 	err = PVRSRVMapFullDmaBuf(
 		      &pSrv->dev_data,
 		      pSrv->h_mapping_heap,
 		      PVRSRV_MAP_NOUSERVIRTUAL,
-		      req.fd,
+		      fd,
 		      (PPVRSRV_CLIENT_MEM_INFO *)&meminfo->hPrivateData);
 
-	close(req.fd);
-
 	if (err != PVRSRV_OK) {
 		ERROR_MSG("PVRSRVMapFullDmaBuf failed: %s fd %d",
-		PVRSRVGetErrorString(err), req.fd);
+		PVRSRVGetErrorString(err), fd);
 		return IMG_FALSE;
 	}
 
@@ -27,7 +27,8 @@ void DeInitialiseServices(ScreenPtr pScreen, PPVRSERVICES pSrv);
 
 int PVRDRMServicesInitStatus(Bool *pbStatus);
 
-IMG_BOOL PVRMapBo(ScreenPtr pScreen, PPVRSERVICES pSrv, int drmFD,
+int PVRExportBo(ScreenPtr pScreen, int drmFD, struct omap_bo *bo);
+IMG_BOOL PVRMapBo(ScreenPtr pScreen, PPVRSERVICES pSrv, int fd,
 		  struct omap_bo *bo, PPVR2DMEMINFO meminfo);
 IMG_BOOL PVRUnMapBo(ScreenPtr pScreen, PPVRSERVICES pSrv,
 		    PPVR2DMEMINFO meminfo);
@@ -40,6 +40,15 @@ pixmap2meminfo(PixmapPtr pPixmap)
 	return pvrPixmapPriv->meminfo.hPrivateData;
 }
 
+/* pixmaps may be sub-allocated from a shared BO */
+static inline IMG_UINT32
+pixmap2devaddr(PixmapPtr pPixmap, PPVRSRV_CLIENT_MEM_INFO psClientMemInfo)
+{
+	OMAPPixmapPrivPtr pixmapPriv = exaGetPixmapDriverPrivate(pPixmap);
+
+	return psClientMemInfo->sDevVAddr.uiAddr + pixmapPriv->offset;
+}
+
 static void
 setsurf(SGXTQ_SURFACE *surf, PixmapPtr pPixmap, PVRSRV_PIXEL_FORMAT fmt)
 {
@@ -52,7 +61,7 @@ setsurf(SGXTQ_SURFACE *surf, PixmapPtr pPixmap, PVRSRV_PIXEL_FORMAT fmt)
 	surf->ui32Width = pPixmap->drawable.width;
 	surf->eFormat = fmt;
 	surf->psSyncInfo = psClientMemInfo->psClientSyncInfo;
-	surf->sDevVAddr.uiAddr = psClientMemInfo->sDevVAddr.uiAddr;
+	surf->sDevVAddr.uiAddr = pixmap2devaddr(pPixmap, psClientMemInfo);
 	surf->i32StrideInBytes = exaGetPixmapPitch(pPixmap);
 }
 
@@ -65,7 +74,7 @@ setsurf_addr(SGXTQ_SURFACE *surf, PixmapPtr pPixmap)
 		return;
 
 	surf->psSyncInfo = psClientMemInfo->psClientSyncInfo;
-	surf->sDevVAddr.uiAddr = psClientMemInfo->sDevVAddr.uiAddr;
+	surf->sDevVAddr.uiAddr = pixmap2devaddr(pPixmap, psClientMemInfo);
 }
 
 #if defined SGX_OMAP_443x
@@ -220,7 +229,6 @@ PUT_TEXTURE_IMAGE_FN_DEF(343x)
 	err = SGXQueueTransfer(pContext->hTransferContext, &sBlitInfo);
 
 	if (err == PVRSRV_OK) {
-		setPixmapOnGPU(pDstPix);
 		flushScanout(pDstPix);
 		return TRUE;
 	}
@@ -281,9 +289,10 @@ PVRRenderAtlas(ScreenPtr pScreen, PVRRenderOp *pRenderOp)
 
 	sBlitInfo.Details.sTAtlas.eOp = eOp;
 	sBlitInfo.Details.sTAtlas.ui32NumMappings = pRenderOp->numBltRects;
+	/* Src is a plain copy, everything else blends */
 	sBlitInfo.Details.sTAtlas.eAlpha =
-			pRenderOp->op = PictOpSrc ?  SGXTQ_ALPHA_SOURCE :
-						     SGXTQ_ALPHA_NONE;
+			pRenderOp->op == PictOpSrc ? SGXTQ_ALPHA_NONE :
+						     SGXTQ_ALPHA_SOURCE;
 	sBlitInfo.Details.sTAtlas.psDstRects = &pRenderOp->bltRects.destRect[0];
 	sBlitInfo.Details.sTAtlas.psSrcRects = &pRenderOp->bltRects.srcRect[0];
 
@@ -313,6 +322,35 @@ PVRRenderAtlas(ScreenPtr pScreen, PVRRenderOp *pRenderOp)
 	return iErr;
 }
 
+/* how a picture is sampled when its rect is stretched */
+static SGXTQ_FILTERTYPE
+PVRPictureFilter(PicturePtr pPicture)
+{
+	switch (pPicture ? pPicture->filter : PictFilterNearest) {
+		case PictFilterBilinear:
+		case PictFilterGood:
+		case PictFilterBest:
+			return SGXTQ_FILTERTYPE_LINEAR;
+		default:
+			return SGXTQ_FILTERTYPE_POINT;
+	}
+}
+
+/*
+ * Only scaled pictures are filtered.  A source rect one texel wide or high
+ * is a PAD edge or a repeated texel, which pixman draws flat, and linear
+ * filtering would blend it with its neighbour or with whatever follows
+ * the surface.
+ */
+static SGXTQ_FILTERTYPE
+PVRRectFilter(PicturePtr pPicture, Bool scaled, SGXHW_RENDER_RECTS *rect)
+{
+	if (!scaled || rect->x1 - rect->x0 <= 1 || rect->y1 - rect->y0 <= 1)
+		return SGXTQ_FILTERTYPE_POINT;
+
+	return PVRPictureFilter(pPicture);
+}
+
 static Bool
 PVRRotateCopyRender(ScreenPtr pScreen, PVRRenderOp *pRenderOp)
 {
@@ -525,14 +563,9 @@ PVRRenderBatch(PVRPtr pPVR, PVRRenderOp *pRenderOp)
 		sBlitInfo.asSrcRects[0].y0 = src->y0;
 		sBlitInfo.asSrcRects[0].y1 = src->y1;
 
-		if (src->x1 - src->x0 != dst->x1 - dst->x0 ||
-		    src->y1 - src->y0 != dst->y1 - dst->y0) {
-			sBlitInfo.Details.sCustomShader.aeFilter[0] =
-					SGXTQ_FILTERTYPE_LINEAR;
-		} else {
-			sBlitInfo.Details.sCustomShader.aeFilter[0] =
-					SGXTQ_FILTERTYPE_POINT;
-		}
+		sBlitInfo.Details.sCustomShader.aeFilter[0] =
+			PVRRectFilter(pRenderOp->pSrcPicture,
+				      pRenderOp->transform == TRANSF_SCALE, src);
 
 		sBlitInfo.Details.sCustomShader.aeFilter[2] =
 				SGXTQ_FILTERTYPE_POINT;
@@ -551,11 +584,11 @@ PVRRenderBatch(PVRPtr pPVR, PVRRenderOp *pRenderOp)
 			sBlitInfo.asSrcRects[2].y0 = mask->y0;
 			sBlitInfo.asSrcRects[2].y1 = mask->y1;
 
-			if (dst->x1 - dst->x0 != mask->x1 - mask->x0 ||
-			    dst->y1 - dst->y0 != mask->y1 - mask->y0) {
-				sBlitInfo.Details.sCustomShader.aeFilter[2] =
-						SGXTQ_FILTERTYPE_LINEAR;
-			}
+			sBlitInfo.Details.sCustomShader.aeFilter[2] =
+				PVRRectFilter(pRenderOp->pMaskPicture,
+					      pRenderOp->pMaskPicture &&
+					      pRenderOp->pMaskPicture->transform,
+					      mask);
 		}
 
 		iErr = SGXQueueTransfer(pContext->hTransferContext,
@@ -664,15 +697,15 @@ PVRRender_DEVICE_DEF(343x)
 		}
 	}
 
+	/* the atlas blit neither turns nor stretches its rects */
 	if (pRenderOp->pSrc &&
 		transform != TRANSF_UNKNOWN && transform != TRANSF_NONE) {
-		if (pRenderOp->pMask)
-			return PVRRenderBatch(pPVR, pRenderOp);
-
-		if (pRenderOp->op == PictOpSrc)
+		if (!pRenderOp->pMask && pRenderOp->op == PictOpSrc &&
+		    transform != TRANSF_SCALE)
 			return PVRRotateCopyRender(pScreen, pRenderOp);
 
-	} else if (pRenderOp->pMask)
+		return PVRRenderBatch(pPVR, pRenderOp);
+	} else if (pRenderOp->pMask || pRenderOp->stretched)
 		return PVRRenderBatch(pPVR, pRenderOp);
 
 	if (pRenderOp->numBltRects < 2 || PVRRenderAtlas(pScreen, pRenderOp))
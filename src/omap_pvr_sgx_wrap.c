@@ -54,6 +54,9 @@ PUT_TEXTURE_IMAGE_FN_DEF(wrap)
 		}
 	}
 
+	sgxQueueFlush(pDstPix->drawable.pScreen);
+	sgxMapOpBegin(pDstPix->drawable.pScreen);
+
 	return PutTextureImageProc(pSrcPix, pSrcBox, pOsdPix, pOsdBox,
 				   pDstPix, pDstBox, extraCount, extraPix,
 				   format);
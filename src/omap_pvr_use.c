@@ -928,6 +928,7 @@ PVRGetUseCodeForRender(PVRRenderOp *pRender)
 							return gsUseCodeFragments.ARGBtoARGBMaskFull[op];
 					case PICT_x8r8g8b8:
 					case PICT_x8b8g8r8:
+					case PICT_r5g6b5:
 						if (maskAlpha)
 							return gsUseCodeFragments.XRGBtoARGBMaskAlpha[op];
 						else
@@ -939,6 +940,7 @@ PVRGetUseCodeForRender(PVRRenderOp *pRender)
 				}
 			case PICT_x8r8g8b8:
 			case PICT_x8b8g8r8:
+			case PICT_r5g6b5:
 				switch (srcFormat) {
 					case PICT_a8r8g8b8:
 					case PICT_a8b8g8r8:
@@ -948,6 +950,7 @@ PVRGetUseCodeForRender(PVRRenderOp *pRender)
 							return gsUseCodeFragments.ARGBtoXRGBMaskFull[op];
 					case PICT_x8r8g8b8:
 					case PICT_x8b8g8r8:
+					case PICT_r5g6b5:
 						if (maskAlpha)
 							return gsUseCodeFragments.XRGBtoXRGBMaskAlpha[op];
 						else
@@ -965,6 +968,7 @@ PVRGetUseCodeForRender(PVRRenderOp *pRender)
 						return gsUseCodeFragments.ARGBtoARGBMaskAlpha[op];
 					case PICT_x8r8g8b8:
 					case PICT_x8b8g8r8:
+					case PICT_r5g6b5:
 						return gsUseCodeFragments.XRGBtoARGBMaskAlpha[op];
 					case PICT_a8:
 						return gsUseCodeFragments.ARGBtoARGBMaskAlpha[op];
@@ -985,6 +989,7 @@ PVRGetUseCodeForRender(PVRRenderOp *pRender)
 						return gsUseCodeFragments.ARGBtoARGB[op];
 					case PICT_x8r8g8b8:
 					case PICT_x8b8g8r8:
+					case PICT_r5g6b5:
 						return gsUseCodeFragments.XRGBtoARGB[op];
 					case PICT_a8:
 						return gsUseCodeFragments.A8toARGB[op];
@@ -994,12 +999,14 @@ PVRGetUseCodeForRender(PVRRenderOp *pRender)
 				break;
 			case PICT_x8r8g8b8:
 			case PICT_x8b8g8r8:
+			case PICT_r5g6b5:
 				switch (srcFormat) {
 					case PICT_a8r8g8b8:
 					case PICT_a8b8g8r8:
 						return gsUseCodeFragments.ARGBtoXRGB[op];
 					case PICT_x8r8g8b8:
 					case PICT_x8b8g8r8:
+					case PICT_r5g6b5:
 						return gsUseCodeFragments.XRGBtoXRGB[op];
 					case PICT_a8:
 						return gsUseCodeFragments.A8toXRGB[op];
@@ -1014,6 +1021,7 @@ PVRGetUseCodeForRender(PVRRenderOp *pRender)
 						return gsUseCodeFragments.ARGBtoARGB[op];
 					case PICT_x8r8g8b8:
 					case PICT_x8b8g8r8:
+					case PICT_r5g6b5:
 						return gsUseCodeFragments.XRGBtoARGB[op];
 					case PICT_a8:
 						return gsUseCodeFragments.ARGBtoARGB[op];
@@ -0,0 +1,210 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "omap_driver.h"
+#include "omap_exa.h"
+
+/* Worker threads for software rendering.  An operation is split into
+ * horizontal bands, the calling thread takes bands as well, and
+ * OMAPBandsRun() only returns once every band is done.  So nothing is
+ * left running when EXA calls FinishAccess() or the next operation
+ * starts.
+ */
+
+#define OMAP_MAX_THREADS 4
+
+typedef struct _OMAPThreads {
+	int count;
+	pthread_t thread[OMAP_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	Bool quit;
+	/* bumped for each operation, so workers see new work */
+	unsigned int generation;
+	/* the current operation: */
+	OMAPBandProc proc;
+	void *closure;
+	int y1, y2;
+	int bands;
+	int next;			/* next band to hand out */
+	int pending;		/* bands not finished yet */
+} OMAPThreadsRec;
+
+/* take bands until none is left, called with the lock held */
+static void
+OMAPBandsWork(OMAPThreadsPtr threads)
+{
+	while (threads->next < threads->bands) {
+		int band = threads->next++;
+		int h = threads->y2 - threads->y1;
+		int y1 = threads->y1 + h * band / threads->bands;
+		int y2 = threads->y1 + h * (band + 1) / threads->bands;
+
+		pthread_mutex_unlock(&threads->lock);
+		threads->proc(threads->closure, y1, y2);
+		pthread_mutex_lock(&threads->lock);
+
+		if (!--threads->pending)
+			pthread_cond_signal(&threads->done);
+	}
+}
+
+static void *
+OMAPThreadMain(void *arg)
+{
+	OMAPThreadsPtr threads = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&threads->lock);
+
+	while (!threads->quit) {
+		if (generation == threads->generation) {
+			pthread_cond_wait(&threads->start, &threads->lock);
+			continue;
+		}
+
+		generation = threads->generation;
+		OMAPBandsWork(threads);
+	}
+
+	pthread_mutex_unlock(&threads->lock);
+
+	return NULL;
+}
+
+/* count < 0 means one thread per additional online CPU */
+_X_EXPORT OMAPThreadsPtr
+OMAPThreadsInit(int count)
+{
+	OMAPThreadsPtr threads;
+	sigset_t set, old;
+
+	if (count < 0)
+		count = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+	if (count > OMAP_MAX_THREADS)
+		count = OMAP_MAX_THREADS;
+
+	if (count <= 0)
+		return NULL;
+
+	threads = calloc(1, sizeof(*threads));
+	if (!threads)
+		return NULL;
+
+	pthread_mutex_init(&threads->lock, NULL);
+	pthread_cond_init(&threads->start, NULL);
+	pthread_cond_init(&threads->done, NULL);
+
+	/* signals are for the main thread (input, smart scheduler) */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+
+	while (threads->count < count) {
+		if (pthread_create(&threads->thread[threads->count], NULL,
+				OMAPThreadMain, threads))
+			break;
+		threads->count++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!threads->count) {
+		OMAPThreadsFini(threads);
+		return NULL;
+	}
+
+	return threads;
+}
+
+_X_EXPORT void
+OMAPThreadsFini(OMAPThreadsPtr threads)
+{
+	int i;
+
+	if (!threads)
+		return;
+
+	pthread_mutex_lock(&threads->lock);
+	threads->quit = TRUE;
+	pthread_cond_broadcast(&threads->start);
+	pthread_mutex_unlock(&threads->lock);
+
+	for (i = 0; i < threads->count; i++)
+		pthread_join(threads->thread[i], NULL);
+
+	pthread_cond_destroy(&threads->done);
+	pthread_cond_destroy(&threads->start);
+	pthread_mutex_destroy(&threads->lock);
+	free(threads);
+}
+
+/**
+ * Run proc over the rows y1..y2, split in bands over the worker threads
+ * if the operation is big enough (width * (y2 - y1) pixels) to pay for
+ * waking them up.  proc must only touch its own rows of the destination.
+ */
+_X_EXPORT void
+OMAPBandsRun(ScreenPtr pScreen, OMAPBandProc proc, void *closure,
+		int y1, int y2, int width)
+{
+	OMAPThreadsPtr threads = OMAPPTR(xf86ScreenToScrn(pScreen))->Threads;
+	int bands;
+
+	if (!threads || width * (y2 - y1) < OMAP_BANDS_MIN_AREA) {
+		proc(closure, y1, y2);
+		return;
+	}
+
+	bands = threads->count + 1;
+	if (bands > y2 - y1)
+		bands = y2 - y1;
+
+	pthread_mutex_lock(&threads->lock);
+
+	threads->proc = proc;
+	threads->closure = closure;
+	threads->y1 = y1;
+	threads->y2 = y2;
+	threads->bands = bands;
+	threads->next = 0;
+	threads->pending = bands;
+	threads->generation++;
+	pthread_cond_broadcast(&threads->start);
+
+	OMAPBandsWork(threads);
+
+	while (threads->pending)
+		pthread_cond_wait(&threads->done, &threads->lock);
+
+	pthread_mutex_unlock(&threads->lock);
+}
@@ -82,8 +82,12 @@ setupplane(ScreenPtr pScreen, PixmapPtr pSrcPix, int width, int height,
 		pSrcPix = NULL;
 	}
 
+	/* Xv planes get BOs of their own, never a share of a slab, as
+	 * they are written by the CPU below
+	 */
 	if (!pSrcPix) {
-		int flags = srcpitch ? OMAP_CREATE_PIXMAP_XV | srcpitch: 0;
+		int flags = OMAP_CREATE_PIXMAP_XV |
+			(srcpitch ? srcpitch : OMAPCalculateStride(width, depth));
 
 		pSrcPix = pScreen->CreatePixmap(pScreen, width, height, depth,
 						flags);
@@ -95,6 +99,10 @@ setupplane(ScreenPtr pScreen, PixmapPtr pSrcPix, int width, int height,
 #endif
 
 	src = omap_bo_map(bo);
+	if (!src)
+		return pSrcPix;
+
+	src += OMAPPixmapOffset(pSrcPix);
 	srcpitch = exaGetPixmapPitch(pSrcPix);
 
 	/* copy from buf to src pixmap: */